@@ -1,107 +1,365 @@
 #include "ai.hpp"
 
 #include <assert.h>
+#include <atomic>
+#include <limits.h>
 #include <math.h>
 #include <omp.h>
 #include <stdbool.h>
+#include <string.h>
+#include <thread>
 #include <time.h>
 
 #include "../lib/debug.hpp"
+#include "../lib/eval_cache.hpp"
 #include "../lib/eval_hashmap.hpp"
+#include "evaluation.hpp"
+#include "nnue.hpp"
+#include "patterns.hpp"
+#include "solved.hpp"
 
 #define START_DEPTH 1
-uint64_t time_limit; //In ms
-uint8_t max_depth = 64;
-
-#ifdef METRICS
-static uint64_t branches = 0;
-static uint64_t branches_evaluated = 0;
-static uint64_t levels_evaluated = 0;
-static uint64_t nr_moves = 0;
-static uint64_t unique_nodes = 0;
-static uint64_t nodes_evaluated = 0;
-#endif
 
-static uint64_t nodes = 0;
-static long end_time_ms;
-static bool finished;
+// Reading the clock at every node is measurable, so it is only read once every
+// TIME_CHECK_NODES nodes. That is well below a millisecond of search.
+#define TIME_CHECK_NODES 1024
 
-static int8_t weights[64] = {
-	20, -3, 11, 8, 8, 11, -3, 20,
-	-3, -7, -4, 1, 1, -4, -7, -3,
-	11, -4, 2, 2, 2, 2, -4, 11,
-	8, 1, 2, -3, -3, 2, 1, 8,
-	8, 1, 2, -3, -3, 2, 1, 8,
-	11, -4, 2, 2, 2, 2, -4, 11,
-	-3, -7, -4, 1, 1, -4, -7, -3,
-	20, -3, 11, 8, 8, 11, -3, 20};
+// Time kept on the clock for the communication with the interface
+#define TIME_SAFETY_MS 20
 
-void set_max_depth(uint8_t depth) {
+// The last moves of the game are solved almost instantly, so the clock is
+// spread over the moves before them, but never over fewer than TIME_MIN_MOVES
+#define TIME_ENDGAME_MOVES 6
+#define TIME_MIN_MOVES 3
+
+// The hard deadline lies at most this many planned move times away
+#define TIME_HARD_FACTOR 3
+
+// Searches that complete at least this depth are kept in the solved position
+// log, if one is open. Shallower searches are cheaper to repeat than to store.
+#define SOLVED_MIN_DEPTH 12
+
+// Searches with different evaluators can share the evaluation cache, so the
+// evaluator is part of its key
+#define EVALUATOR_SALT 0x9E3779B97F4A7C15ULL
+
+// Builds with PERF measure one in PERF_SAMPLE_CALLS calls of the hot
+// functions. Reading the counters costs about as much as the cheaper ones.
+#define PERF_SAMPLE_CALLS 256
+
+// The clock is per thread, every thread of a search counts its own nodes
+static thread_local uint16_t time_check = TIME_CHECK_NODES;
+
+// The search behind the free functions
+static Search default_search;
+
+Search::Search() : own_table(), position(), thread_stats(1), last_stats(), total_stats() {
+	table = &own_table;
+	max_depth = 64;
+	multi_pv = 1;
+	solved_min_depth = SOLVED_MIN_DEPTH;
+	evaluator = CLASSIC;
+
+	lmr_min_depth = 3;
+	lmr_min_move = 3;
+	lmr_endgame = 14;
+	lmr_base = 0.25;
+	lmr_divisor = 2.5;
+	init_lmr_table();
+
+	start_time_ms = 0;
+	soft_time_ms = 0;
+	hard_time_ms = 0;
+	soft_end_ms = 0;
+	end_time_ms = 0;
+	infinite = false;
+	log_time = false;
+	finished = false;
+
+	search_result = -1;
+	last_result.move = -1;
+	last_result.info = search_info_t();
+	search_start_nodes = 0;
+	node_limit = 0;
+	depth_limit = 0;
+	search_time_ms = 0;
+	levels_evaluated = 0;
+	nr_searches = 0;
+	trace_file = NULL;
+	trace_start_ns = 0;
+}
+
+Search::~Search() {
+	stop();
+	wait();
+	free_map(&own_table);
+	set_trace_file(NULL);
+#ifdef TRACE
+	for (trace_buffer_t &buffer : trace_buffers)
+		free_trace_buffer(&buffer);
+#endif
+}
+
+void Search::set_max_depth(uint8_t depth) {
 	max_depth = depth;
 }
 
+void Search::set_multi_pv(uint8_t moves) {
+	multi_pv = moves > 0 ? moves : 1;
+}
+
+void Search::set_solved_min_depth(uint8_t depth) {
+	solved_min_depth = depth;
+}
+
+bool Search::set_evaluator(evaluator_t e) {
+	if (e == PATTERN && !patterns_loaded())
+		return false;
+	if (e == NNUE && !nnue_loaded())
+		return false;
+	// The evaluator is part of the key of the evaluation cache, so the values
+	// of other evaluators stay where they are, other searches may use them
+	evaluator = e;
+	return true;
+}
+
+void Search::init_lmr_table(void) {
+	for (uint8_t depth = 0; depth < 64; ++depth) {
+		for (uint8_t move = 0; move < 64; ++move) {
+			if (depth == 0 || move == 0) {
+				lmr_table[depth][move] = 0;
+				continue;
+			}
+
+			double r = lmr_base + log(depth) * log(move) / lmr_divisor;
+			r = fmax(r, 0);
+
+			// Never reduce straight into the evaluation function
+			lmr_table[depth][move] = (uint8_t) fmin(r, depth > 1 ? depth - 2 : 0);
+		}
+	}
+}
+
+void Search::set_lmr_min_depth(uint8_t depth) {
+	lmr_min_depth = depth;
+}
+
+void Search::set_lmr_min_move(uint8_t move) {
+	lmr_min_move = move;
+}
+
+void Search::set_lmr_endgame(uint8_t empties) {
+	lmr_endgame = empties;
+}
+
+void Search::set_lmr_base(double base) {
+	lmr_base = base;
+	init_lmr_table();
+}
+
+void Search::set_lmr_divisor(double divisor) {
+	if (divisor > 0)
+		lmr_divisor = divisor;
+	init_lmr_table();
+}
+
+void Search::set_info_callback(std::function<void(const search_info_t *info)> callback) {
+	info_callback = callback;
+}
+
+bool Search::set_trace_file(const char *path) {
+	if (trace_file != NULL)
+		fclose(trace_file);
+	trace_file = NULL;
+	if (path == NULL)
+		return true;
+
+#ifdef TRACE
+	trace_file = fopen(path, "ab");
+	return trace_file != NULL;
+#else
+	return false;
+#endif
+}
+
+void Search::set_hash(size_t size_mb) {
+	set_map_size(&own_table, size_mb);
+}
+
+void Search::set_table(eval_map_t *shared_table) {
+	table = shared_table != NULL ? shared_table : &own_table;
+}
+
+void Search::set_position(board_t board) {
+	position = board;
+}
+
 static long get_time_ms(void) {
 	struct timespec spec;
 
-	clock_gettime(CLOCK_REALTIME, &spec);
-	return spec.tv_nsec / 1.0e6 + spec.tv_sec * 1000;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
 }
 
-double evaluation(board_t board) {
+/**
+ * Plans the time for this move. The soft limit is what we would like to use,
+ * the hard limit is where the search is aborted.
+ */
+static void plan_time(board_t board, const search_limits_t *limits, long *soft_ms, long *hard_ms) {
+	if (limits->move_time_ms > 0) {
+		*soft_ms = limits->move_time_ms;
+		*hard_ms = limits->move_time_ms;
+		return;
+	}
+
+	// We play every other empty square
+	uint64_t moves = (count(~(board.player | board.opponent)) + 1) / 2;
+	if (moves > TIME_ENDGAME_MOVES + TIME_MIN_MOVES)
+		moves -= TIME_ENDGAME_MOVES;
+	else
+		moves = TIME_MIN_MOVES;
+
+	if (limits->moves_to_go > 0 && limits->moves_to_go < moves)
+		moves = limits->moves_to_go;
+
+	uint64_t available = limits->remaining_ms > TIME_SAFETY_MS ? limits->remaining_ms - TIME_SAFETY_MS : 0;
+	uint64_t soft = available / moves + limits->increment_ms * 3 / 4;
+	uint64_t hard = soft * TIME_HARD_FACTOR;
+	if (hard > available)
+		hard = available;
+	if (soft > hard)
+		soft = hard;
+
+	*soft_ms = soft > 0 ? soft : 1;
+	*hard_ms = hard > 0 ? hard : 1;
+}
+
+double Search::evaluation(board_t board) const {
 	// Reached the last move. If we are winning, assign a BIG score to us
 	if (~(board.opponent | board.player) == 0)
 		return (count(board.player) - count(board.opponent)) * 8192;
 
-	double a, b, c;
-	double my_discs = 0;
-	double opp_discs = 0;
-	double weight_score = 0;
-
-	for (int i = 0; i < 64; ++i) {
-		if (is_set(board.player, i)) {
-			weight_score += weights[i];
-			my_discs++;
-		} else if (is_set(board.opponent, i)) {
-			weight_score -= weights[i];
-			opp_discs++;
-		}
+	switch (evaluator) {
+		case PATTERN:
+			return pattern_evaluation(board);
+		case NNUE:
+			return nnue_evaluation(board);
+		case CLASSIC:
+		default:
+			return classic_evaluation(board);
 	}
-	if (my_discs > opp_discs)
-		a = (100.0 * my_discs) / (my_discs + opp_discs);
-	else if (my_discs < opp_discs)
-		a = -(100.0 * opp_discs) / (my_discs + opp_discs);
-	else a = 0;
-
-	my_discs = opp_discs = 0;
-	if (is_set(board.player, 0)) my_discs++;
-	else if (is_set(board.opponent, 0)) opp_discs++;
-	if (is_set(board.player, 7)) my_discs++;
-	else if (is_set(board.opponent, 7)) opp_discs++;
-	if (is_set(board.player, 56)) my_discs++;
-	else if (is_set(board.opponent, 56)) opp_discs++;
-	if (is_set(board.player, 63)) my_discs++;
-	else if (is_set(board.opponent, 63)) opp_discs++;
-	b = 25 * (my_discs - opp_discs);
-
-	uint8_t player_mob = count(get_valid_moves(board));
-	switch_boards(&board);
-	uint8_t opponent_mob = count(get_valid_moves(board));
-	switch_boards(&board);
-
-	if (player_mob > opponent_mob)
-		c = (100.0 * player_mob) / (player_mob + opponent_mob);
-	else if (player_mob < opponent_mob)
-		c = -(100.0 * opponent_mob) / (player_mob + opponent_mob);
-	else c = 0;
-
-	return (10 * a) + (801.724 * b) + (78.922 * c) + (10 * weight_score);
+}
+
+/**
+ * The evaluation at the leaves of the search, which finishes the incremental
+ * state instead of evaluating the board from scratch. Leaves that were seen
+ * before come from the evaluation cache.
+ */
+double Search::leaf_evaluation(board_t board, const eval_state_t *state, node_stats_t *stats) {
+	uint64_t empty = ~(board.opponent | board.player);
+	if (empty == 0)
+		return (count(board.player) - count(board.opponent)) * 8192;
+
+	double value;
+	uint64_t hash = hash_board(board) + evaluator * EVALUATOR_SALT;
+	if (probe_eval_cache(hash, &value)) {
+		stats->cache_hits++;
+		return value;
+	}
+	stats->cache_misses++;
+
+	switch (evaluator) {
+		case PATTERN:
+			value = pattern_evaluation_indices(state->pattern_indices[state->side], count(empty));
+			break;
+		case NNUE:
+			value = nnue_evaluation_accumulators(state->accumulators[state->side], state->accumulators[state->side ^ 1]);
+			break;
+		case CLASSIC:
+		default:
+			value = classic_evaluation_state(board, state);
+			break;
+	}
+
+	store_eval_cache(hash, value);
+	return value;
+}
+
+/**
+ * Calls the function, and in builds with PERF measures it with the hardware
+ * counters of the thread, once every PERF_SAMPLE_CALLS calls
+ */
+template <typename F>
+static inline auto measure(node_stats_t *stats, perf_function_t function, F call) -> decltype(call()) {
+#ifdef PERF
+	if (stats->function_calls[function]++ % PERF_SAMPLE_CALLS != 0)
+		return call();
+
+	stats->function_samples[function]++;
+	perf_snapshot_t start;
+	perf_read(&start);
+	auto result = call();
+	perf_add_since(&start, &stats->function_perf[function]);
+	return result;
+#else
+	(void) stats;
+	(void) function;
+	return call();
+#endif
+}
+
+/**
+ * Counts a probe of the table, and traces its outcome
+ */
+static inline void count_probe(node_stats_t *stats, uint8_t depth, probe_outcome_t outcome) {
+	stats->probes[depth][outcome]++;
+#ifdef TRACE
+	stats->trace_node->probe = outcome;
+#endif
+}
+
+static inline void count_cutoff(node_stats_t *stats, uint8_t move_index) {
+	stats->cutoffs[move_index]++;
+#ifdef TRACE
+	stats->trace_node->cutoff = move_index;
+#endif
+}
+
+static inline void count_branches(node_stats_t *stats, uint8_t moves, uint8_t searched) {
+	stats->branches += moves;
+	stats->branches_evaluated += searched;
+#ifdef TRACE
+	stats->trace_node->moves = moves;
+	stats->trace_node->searched = searched;
+#endif
+}
+
+/**
+ * Plays a move on a copy of the board and of its evaluation state, and
+ * switches to the perspective of the other player. The parent keeps its own
+ * board and state, so nothing has to be undone afterwards.
+ */
+static board_t make_move(board_t board, const eval_state_t *state, uint8_t move, eval_state_t *child_state, node_stats_t *stats) {
+	return measure(stats, PERF_DO_MOVE, [&]() {
+		board_t new_board = board;
+		do_move(&new_board, move);
+
+		copy_eval_state(child_state, state);
+		update_eval_state(child_state, move, board.opponent & ~new_board.opponent);
+
+		// We want the perspective of the other player in the recursive call
+		switch_boards(&new_board);
+		return new_board;
+	});
 }
 
 /**
  * This function fetches the best child from the hashmap
- * It is important that at least one child has a value in the hashtable
+ * It is important that at least one child has an exact value in the hashtable.
+ * Children that were only tested with a null window have bounds, those are
+ * skipped.
  */
-static int8_t get_best_move(board_t board, uint64_t valid) {
+int8_t Search::get_best_move(board_t board, uint64_t valid, double *value) {
 	double best_value = -INFINITY;
 
 	// Set the least significant set bit in the valid bitmask as default move
@@ -113,98 +371,252 @@ static int8_t get_best_move(board_t board, uint64_t valid) {
 			do_move(&new_board, i);
 			switch_boards(&new_board);
 
-			board_eval_t *eval = find_eval(new_board);
-			if (eval != NULL) {
-				if (-eval->value > best_value) {
-					best_value = -eval->value;
+			board_eval_t eval;
+			if (find_eval(table, new_board, evaluator, &eval) && eval.bound == BOUND_EXACT) {
+				if (-eval.value > best_value) {
+					best_value = -eval.value;
 					best_move = i;
 				}
 			}
 		}
 	}
+
+	if (value != NULL)
+		*value = best_value;
 	return best_move;
 }
 
-double negamax(board_t board, uint64_t depth, double alpha, double beta, int8_t player) {
-#ifdef METRICS
-	uint8_t children_evaluated = 0;
+/**
+ * Follows the best moves stored in the hashtable, starting with the given
+ * move on the root board. Boards are stored from the perspective of the
+ * opponent of the player at the root, so every other board is switched for
+ * the lookup. The variation ends at the first pass.
+ *
+ * @return The length of the variation
+ */
+uint8_t Search::get_pv(board_t board, uint8_t move, uint8_t *pv) {
+	uint8_t length = 0;
+	bool root_player = true;
+
+	while (length < 64) {
+		pv[length++] = move;
+		do_move(&board, move);
+		switch_boards(&board);
+		root_player = !root_player;
+
+		board_t key = board;
+		if (root_player)
+			switch_boards(&key);
+
+		board_eval_t eval;
+		if (!find_eval(table, key, evaluator, &eval) || !is_set(get_valid_moves(board), eval.best_move))
+			break;
+		move = eval.best_move;
+	}
+	return length;
+}
+
+/**
+ * Looks the board up in the table. Boards are stored from the perspective of
+ * the player at the root, so the board of the opponent is switched first.
+ * They are tagged with the evaluator, whose values they hold, so searches
+ * with other evaluators can share the table.
+ */
+bool Search::find_board(board_t board, int8_t player, board_eval_t *eval) {
+	if (player != 1)
+		switch_boards(&board);
+	return find_eval(table, board, evaluator, eval);
+}
+
+/**
+ * Stores the board in the table, see find_board
+ *
+ * @return Whether it was stored, if not value is that of the table
+ */
+bool Search::store_board(board_t board, int8_t player, double *value, uint8_t depth, uint8_t bound, uint8_t best_move) {
+	if (player != 1)
+		switch_boards(&board);
+	return store_eval(table, board, evaluator, value, depth, bound, best_move);
+}
+
+/**
+ * Starts loading the bucket of a child into the cache, before the child
+ * looks it up
+ */
+void Search::prefetch_board(board_t board, int8_t player) const {
+	if (player != 1)
+		switch_boards(&board);
+	prefetch_eval(table, board, evaluator);
+}
+
+double Search::negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player) {
+	return negamax(board, state, depth, alpha, beta, player, &thread_stats[0]);
+}
+
+#ifdef TRACE
+/**
+ * Traces the node: the record is filled in while the node is searched, and
+ * written when it is left, with the time it took
+ */
+double Search::negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player, node_stats_t *stats) {
+	uint64_t start_ns = trace_time_ns();
+	trace_record_t *parent = stats->trace_node;
+
+	trace_record_t record = {};
+	record.time_ns = start_ns - trace_start_ns;
+	record.alpha = alpha;
+	record.beta = beta;
+	record.kind = TRACE_NODE;
+	record.depth = depth < UINT8_MAX ? depth : UINT8_MAX;
+	record.ply = parent != NULL ? parent->ply + 1 : 0;
+	record.probe = TRACE_NO_PROBE;
+	record.cutoff = TRACE_NO_CUTOFF;
+
+	stats->trace_node = &record;
+	double value = negamax_node(board, state, depth, alpha, beta, player, stats);
+	stats->trace_node = parent;
+
+	uint64_t duration_ns = trace_time_ns() - start_ns;
+	record.duration_ns = duration_ns < UINT32_MAX ? duration_ns : UINT32_MAX;
+	record.value = value;
+	if (stats->trace != NULL)
+		trace_write(stats->trace, &record);
+	return value;
+}
+
+double Search::negamax_node(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player, node_stats_t *stats) {
+#else
+double Search::negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player, node_stats_t *stats) {
 #endif
+	uint8_t children_evaluated = 0;
+	uint8_t stats_depth = depth < STATS_DEPTHS ? depth : STATS_DEPTHS - 1;
 
-	nodes++;
+	stats->nodes++;
 
 	// If we should be done with regards to time,
 	// end this evaluation
 	// Note: It does not matter what we return, because as soon as finished is
 	// set to true, all results are disregarded
-	if (get_time_ms() >= end_time_ms) {
-		finished = true;
+	if (finished)
 		return -INFINITY;
+	if (--time_check == 0) {
+		time_check = TIME_CHECK_NODES;
+		if (get_time_ms() >= end_time_ms || (node_limit > 0 && count_nodes() - search_start_nodes >= node_limit)) {
+			finished = true;
+			return -INFINITY;
+		}
 	}
 
 	// Lookup board in hash table. We have to switch the board in order to get
 	// the correct hash since the hash takes color into consideration.
-	board_eval_t *eval = NULL;
-	if (player == 1)
-		eval = find_eval(board);
-	else {
-		switch_boards(&board);
-		eval = find_eval(board);
-		switch_boards(&board);
-	}
+	board_eval_t eval;
+	bool found = measure(stats, PERF_FIND_EVAL, [&]() { return find_board(board, player, &eval); });
 
-	if (eval != NULL && eval->depth >= depth)
-		return eval->value;
+	// A bound only ends the search when it lies outside the window
+	bool usable = found && (eval.bound == BOUND_EXACT
+			|| (eval.bound == BOUND_LOWER && eval.value >= beta)
+			|| (eval.bound == BOUND_UPPER && eval.value <= alpha));
+	if (!found) {
+		count_probe(stats, stats_depth, PROBE_MISS);
+	} else if (usable && eval.depth >= depth) {
+		count_probe(stats, stats_depth, PROBE_CUTOFF);
+		return eval.value;
+	} else {
+		count_probe(stats, stats_depth, PROBE_SHALLOW);
+	}
 
-	// Depth 0, use evaluation function
+	// Depth 0, use evaluation function. The board is from the perspective of
+	// the player to move, and so is the evaluation.
 	if (depth == 0 || ~(board.player | board.opponent) == 0)
-		return player * evaluation(board);
+		return measure(stats, PERF_EVALUATION, [&]() { return leaf_evaluation(board, state, stats); });
 
 	double value = -INFINITY;
-	uint64_t valid = get_valid_moves(board);
+	double window_alpha = alpha;
+	uint64_t valid = measure(stats, PERF_VALID_MOVES, [&]() { return get_valid_moves(board); });
+
+	// Without a move the player passes, and when the opponent can not move
+	// either the game is over. A pass does not use up depth, so a search as
+	// deep as there are empty squares reads the game out to the end.
+	if (valid == 0) {
+		board_t passed = board;
+		switch_boards(&passed);
+		if (get_valid_moves(passed) == 0)
+			return (count(board.player) - count(board.opponent)) * 8192;
+
+		eval_state_t passed_state;
+		copy_eval_state(&passed_state, state);
+		switch_eval_state(&passed_state);
+
+		// The player only decides how the board is stored (see find_board),
+		// by the number of discs. With a switched player, the passed board
+		// would be stored as this board.
+		value = -negamax(passed, &passed_state, depth, -beta, -alpha, player, stats);
+	}
 
 	uint8_t best_move = 64;
+	uint8_t move_index = 0;
+
+	// Reductions are only worth it in the midgame at sufficient depth. Near
+	// the end of the game every move has to be read out exactly.
+	bool reduce = depth >= lmr_min_depth && count(~(board.player | board.opponent)) > lmr_endgame;
+	uint8_t *reductions = lmr_table[depth > 63 ? 63 : depth];
+
+	eval_state_t child_state;
+
+	// Every child first looks itself up in the table. Their buckets are
+	// loaded all at once now, instead of one miss after the other.
+	for (uint64_t moves = valid; moves != 0; moves &= moves - 1) {
+		board_t child = board;
+		do_move(&child, __builtin_ctzll(moves));
+		switch_boards(&child);
+		prefetch_board(child, -player);
+	}
 
 	// MOVE ORDERING
-	if (eval != NULL) {
-		best_move = eval->best_move;
+	if (found) {
+		best_move = eval.best_move;
 		if (is_set(valid, best_move)) {
-			board_t new_board = {.player = board.player, .opponent = board.opponent};
-			do_move(&new_board, best_move);
+			board_t new_board = make_move(board, state, best_move, &child_state, stats);
 
-			// We want the perspective of the other player in the recursive call
-			switch_boards(&new_board);
-
-			value = -negamax(new_board, depth - 1, -beta, -alpha, -player);
+			value = -negamax(new_board, &child_state, depth - 1, -beta, -alpha, -player, stats);
 			alpha = fmax(alpha, value);
-
-#ifdef METRICS
+			move_index++;
 			children_evaluated++;
-#endif
 		}
 	}
 
 	for (uint8_t i = 0; !finished && i < 64; ++i) {
 		if (is_set(valid, i) && i != best_move) {
-			board_t new_board = {.player = board.player, .opponent = board.opponent};
-			do_move(&new_board, i);
+			board_t new_board = make_move(board, state, i, &child_state, stats);
 
-			// We want the perspective of the other player in the recursive call
-			switch_boards(&new_board);
+			double new_value;
+			if (reduce && move_index >= lmr_min_move && reductions[move_index] > 0) {
+				new_value = -negamax(new_board, &child_state, depth - 1 - reductions[move_index], -beta, -alpha, -player, stats);
+				stats->lmr_reduced++;
+
+				// The reduced search claims this move is better than what we
+				// have, verify that claim at full depth
+				if (!finished && new_value > alpha) {
+					new_value = -negamax(new_board, &child_state, depth - 1, -beta, -alpha, -player, stats);
+					stats->lmr_researched++;
+				}
+			} else {
+				new_value = -negamax(new_board, &child_state, depth - 1, -beta, -alpha, -player, stats);
+			}
+			move_index++;
 
-			double new_value = -negamax(new_board, depth - 1, -beta, -alpha, -player);
 			if (new_value > value) {
 				best_move = i;
 				value = new_value;
 			}
 
 			alpha = fmax(alpha, new_value);
-
-#ifdef METRICS
 			children_evaluated++;
-#endif
 
-			if (alpha >= beta)
+			if (alpha >= beta) {
+				count_cutoff(stats, move_index - 1);
 				break;
+			}
 		}
 	}
 
@@ -212,69 +624,370 @@ double negamax(board_t board, uint64_t depth, double alpha, double beta, int8_t
 	if (finished)
 		return value;
 
-#ifdef METRICS
-	// Ensure that we don't get mixed up print data (hampers performance)
-	uint8_t children = count(valid);
-	branches += children;
-	branches_evaluated += children_evaluated;
+	count_branches(stats, count(valid), children_evaluated);
+
+	// A value outside the window is only a bound, the moves that were not
+	// searched, or searched with a narrower window, could change it
+	uint8_t bound = BOUND_EXACT;
+	if (value <= window_alpha)
+		bound = BOUND_UPPER;
+	else if (value >= beta)
+		bound = BOUND_LOWER;
+
+	// Another thread may have stored the board deeper meanwhile, then its
+	// value is returned instead
+	stats->nodes_evaluated++;
+	if (measure(stats, PERF_STORE_EVAL, [&]() { return store_board(board, player, &value, depth, bound, best_move); }))
+		stats->unique_nodes++;
+
+	return value;
+}
+
+/**
+ * The nodes the threads of the search counted so far. The other threads may
+ * still be counting, so this is only exact after the search.
+ */
+uint64_t Search::count_nodes(void) const {
+	uint64_t nodes = 0;
+	for (const node_stats_t &stats : thread_stats)
+		nodes += stats.nodes;
+	return nodes;
+}
+
+/**
+ * Adds up the counters of the threads after a search
+ */
+void Search::add_node_stats(void) {
+	search_stats_t *last = &last_stats;
+	for (const node_stats_t &stats : thread_stats) {
+		last->branches += stats.branches;
+		last->branches_evaluated += stats.branches_evaluated;
+		last->nodes_evaluated += stats.nodes_evaluated;
+		last->unique_nodes += stats.unique_nodes;
+		last->lmr_reduced += stats.lmr_reduced;
+		last->lmr_researched += stats.lmr_researched;
+		last->cache_hits += stats.cache_hits;
+		last->cache_misses += stats.cache_misses;
+		// Every node that is not aborted probes the table once
+		for (uint8_t depth = 0; depth < STATS_DEPTHS; ++depth) {
+			for (uint8_t outcome = 0; outcome < PROBE_OUTCOMES; ++outcome) {
+				last->probes[depth][outcome] += stats.probes[depth][outcome];
+				last->depth_nodes[depth] += stats.probes[depth][outcome];
+			}
+			last->table_misses += stats.probes[depth][PROBE_MISS];
+			last->table_hits += stats.probes[depth][PROBE_SHALLOW] + stats.probes[depth][PROBE_CUTOFF];
+		}
+		for (uint8_t move = 0; move < STATS_MOVES; ++move)
+			last->cutoffs[move] += stats.cutoffs[move];
+#ifdef PERF
+		perf_add(&last->perf, &stats.perf);
+		for (uint8_t function = 0; function < PERF_FUNCTIONS; ++function) {
+			last->function_calls[function] += stats.function_calls[function];
+			last->function_samples[function] += stats.function_samples[function];
+			perf_add(&last->function_perf[function], &stats.function_perf[function]);
+		}
 #endif
+	}
+	last->nodes = count_nodes() - search_start_nodes;
 
-	// Lookup board in hash table (again)
-	if (player == 1)
-		eval = find_eval(board);
-	else {
-		switch_boards(&board);
-		eval = find_eval(board);
-		switch_boards(&board);
+	search_stats_t *total = &total_stats;
+	total->nodes += count_nodes();
+	total->branches += last->branches;
+	total->branches_evaluated += last->branches_evaluated;
+	total->nodes_evaluated += last->nodes_evaluated;
+	total->unique_nodes += last->unique_nodes;
+	total->lmr_reduced += last->lmr_reduced;
+	total->lmr_researched += last->lmr_researched;
+	total->cache_hits += last->cache_hits;
+	total->cache_misses += last->cache_misses;
+	total->table_hits += last->table_hits;
+	total->table_misses += last->table_misses;
+	for (uint8_t depth = 0; depth < STATS_DEPTHS; ++depth) {
+		total->depth_nodes[depth] += last->depth_nodes[depth];
+		for (uint8_t outcome = 0; outcome < PROBE_OUTCOMES; ++outcome)
+			total->probes[depth][outcome] += last->probes[depth][outcome];
+	}
+	for (uint8_t move = 0; move < STATS_MOVES; ++move)
+		total->cutoffs[move] += last->cutoffs[move];
+#ifdef PERF
+	perf_add(&total->perf, &last->perf);
+	for (uint8_t function = 0; function < PERF_FUNCTIONS; ++function) {
+		total->function_calls[function] += last->function_calls[function];
+		total->function_samples[function] += last->function_samples[function];
+		perf_add(&total->function_perf[function], &last->function_perf[function]);
 	}
-#ifdef METRICS
-	nodes_evaluated++;
 #endif
-	if (eval != NULL && eval->depth >= depth) {
-		return eval->value;
-	} else if (eval == NULL) {
-		eval = (board_eval_t *) malloc(sizeof(*eval));
-		eval->board.player = player == 1 ? board.player : board.opponent;
-		eval->board.opponent = player == 1 ? board.opponent : board.player;
-
-		// Note, we add first, based on only the board
-		// after that, we set the values
-		add_eval(eval);
-	}
-	eval->value = value;
-	eval->depth = depth;
-	eval->best_move = best_move;
-
-#ifdef METRICS
-	unique_nodes++;
+}
+
+#ifdef TRACE
+/**
+ * Traces the start or end of a root search or an iteration
+ */
+void Search::trace_span(trace_kind_t kind, uint8_t depth, uint8_t move, node_stats_t *stats) {
+	trace_record_t record = {};
+	record.time_ns = trace_time_ns() - trace_start_ns;
+	record.kind = kind;
+	record.depth = depth;
+	record.probe = TRACE_NO_PROBE;
+	record.cutoff = move;
+	trace_write(stats->trace, &record);
+}
+#endif
+
+/**
+ * Appends the trace of the last search to the trace file, if there is one
+ */
+void Search::flush_trace(void) {
+#ifdef TRACE
+	if (trace_file != NULL && !write_trace(trace_file, position.player, position.opponent, trace_buffers.data(), thread_stats.size()))
+		fprintf(stderr, "Could not write the trace\n");
 #endif
+}
 
+/**
+ * Sets the deadlines for a search of the board that starts now
+ */
+void Search::set_deadlines(board_t board, const search_limits_t *limits) {
+	long now_ms = get_time_ms();
+	start_time_ms = now_ms;
+	infinite = false;
+	search_start_nodes = count_nodes();
+	node_limit = limits->max_nodes;
+	depth_limit = limits->max_depth;
+
+	// Only the depth or node limit ends a search without a time or a clock
+	bool timed = limits->move_time_ms > 0 || limits->remaining_ms > 0 || limits->increment_ms > 0;
+	if (!timed && (limits->max_nodes > 0 || limits->max_depth > 0)) {
+		soft_time_ms = 0;
+		hard_time_ms = LONG_MAX;
+		soft_end_ms = LONG_MAX;
+		end_time_ms = LONG_MAX;
+		log_time = false;
+		return;
+	}
+
+	long soft_ms, hard_ms;
+	plan_time(board, limits, &soft_ms, &hard_ms);
+
+	soft_time_ms = soft_ms;
+	hard_time_ms = hard_ms;
+	soft_end_ms = now_ms + soft_ms;
+	end_time_ms = now_ms + hard_ms;
+	log_time = limits->move_time_ms == 0;
+}
+
+void Search::prepare(const search_limits_t *limits) {
+	finished = false;
+	last_result.move = -1;
+	last_result.info = search_info_t();
+
+#ifdef PARALLEL
+	thread_stats.assign(omp_get_max_threads(), node_stats_t());
+#else
+	thread_stats.assign(1, node_stats_t());
+#endif
+	last_stats = search_stats_t();
+
+#ifdef TRACE
+	// The buffers are kept between searches, they are large
+	while (trace_buffers.size() < thread_stats.size()) {
+		trace_buffers.emplace_back();
+		init_trace_buffer(&trace_buffers.back());
+	}
+	for (size_t i = 0; i < thread_stats.size(); ++i) {
+		trace_buffers[i].written = 0;
+		thread_stats[i].trace = &trace_buffers[i];
+	}
+	trace_start_ns = trace_time_ns();
+#endif
+
+	if (limits->infinite) {
+		start_time_ms = get_time_ms();
+		soft_end_ms = LONG_MAX;
+		end_time_ms = LONG_MAX;
+		log_time = false;
+		infinite = true;
+		search_start_nodes = 0;
+		node_limit = 0;
+		depth_limit = 0;
+	} else {
+		set_deadlines(position, limits);
+	}
+
+	init_map(table);
+	age_map(table);
+}
+
+/**
+ * What one thread does of the search of a move at the root: it searches the
+ * move at depth_inc depths, the deepest last. Builds with PERF count the
+ * hardware events of the thread meanwhile, builds with TRACE trace it.
+ *
+ * @return The value of the deepest search, for the player after the move
+ */
+double Search::search_root_thread(board_t new_board, const eval_state_t *child_state, uint8_t depth, uint8_t depth_inc, double alpha, double beta, node_stats_t *stats) {
+	double value = INFINITY;
+#ifdef TRACE
+	uint8_t move = __builtin_ctzll((new_board.player | new_board.opponent) & ~(position.player | position.opponent));
+	trace_span(TRACE_ROOT_BEGIN, depth, move, stats);
+#endif
+#ifdef PERF
+	perf_open_thread();
+	perf_snapshot_t start;
+	perf_read(&start);
+#endif
+	for (uint8_t depth_delta = 0; !finished && depth_delta < depth_inc; depth_delta++)
+		value = negamax(new_board, child_state, depth + depth_delta, -beta, -alpha, 1, stats);
+#ifdef PERF
+	perf_add_since(&start, &stats->perf);
+#endif
+#ifdef TRACE
+	trace_span(TRACE_ROOT_END, depth, move, stats);
+#endif
 	return value;
 }
 
-int8_t ai_turn(board_t board, uint64_t time_ms) {
-	time_limit = time_ms;
-#ifdef DEBUG
-	long start_time_ms = get_time_ms();
-	end_time_ms = start_time_ms + time_limit;
+/**
+ * Searches a move at the root with a window from the perspective of the
+ * player at the root. In the parallel build every thread searches the move at
+ * depth_inc depths, and the result of the deepest search of the master thread
+ * is returned.
+ *
+ * @return The value of the move for the player at the root
+ */
+double Search::search_root_move(board_t new_board, const eval_state_t *child_state, uint8_t depth, uint8_t depth_inc, double alpha, double beta) {
+	double value = INFINITY;
+#ifdef PARALLEL
+#pragma omp parallel
+	{
+		double thread_value = search_root_thread(new_board, child_state, depth, depth_inc, alpha, beta, &thread_stats[omp_get_thread_num()]);
+#pragma omp master
+		value = thread_value;
+	}
 #else
-	end_time_ms = get_time_ms() + time_limit;
+	value = search_root_thread(new_board, child_state, depth, depth_inc, alpha, beta, &thread_stats[0]);
 #endif
+	return -value;
+}
 
-	finished = false;
+/**
+ * The multi_pv-th best of the exactly known scores
+ */
+double Search::kth_score(const uint8_t *moves, uint8_t nr_moves, const double *scores, const bool *exact) const {
+	double top[64];
+	uint8_t nr_top = 0;
+
+	for (uint8_t i = 0; i < nr_moves; ++i) {
+		if (!exact[moves[i]])
+			continue;
+
+		// Insert in descending order
+		uint8_t j = nr_top++;
+		for (; j > 0 && top[j - 1] < scores[moves[i]]; --j)
+			top[j] = top[j - 1];
+		top[j] = scores[moves[i]];
+	}
+
+	return nr_top >= multi_pv ? top[multi_pv - 1] : -INFINITY;
+}
+
+/**
+ * Sorts the moves on their scores, best first. Moves with equal scores keep
+ * their order.
+ */
+static void sort_moves(uint8_t *moves, uint8_t nr_moves, const double *scores) {
+	for (uint8_t i = 1; i < nr_moves; ++i) {
+		uint8_t move = moves[i];
+		uint8_t j = i;
+		for (; j > 0 && scores[moves[j - 1]] < scores[move]; --j)
+			moves[j] = moves[j - 1];
+		moves[j] = move;
+	}
+}
+
+/**
+ * One iteration of the MultiPV search. The best moves of the previous
+ * iteration are searched first. As long as fewer than multi_pv moves have an
+ * exact score, moves are searched with a full window. All others are only
+ * tested with a null window against the multi_pv-th best score, and searched
+ * with a full window when they turn out to be better.
+ *
+ * @param scores - the score of every move, which are bounds unless exact is set
+ */
+void Search::search_multi_pv(board_t board, const eval_state_t *state, uint8_t *moves, uint8_t nr_moves, uint8_t depth, uint8_t depth_inc, double *scores, bool *exact) {
+	eval_state_t child_state;
+	uint8_t nr_exact = 0;
+
+	sort_moves(moves, nr_moves, scores);
+	for (uint8_t i = 0; i < nr_moves; ++i)
+		exact[moves[i]] = false;
+
+	for (uint8_t i = 0; !finished && i < nr_moves; ++i) {
+		uint8_t move = moves[i];
+		board_t new_board = make_move(board, state, move, &child_state, &thread_stats[0]);
 
-	init_map();
+		double value;
+		bool is_exact = true;
+		if (nr_exact < multi_pv) {
+			value = search_root_move(new_board, &child_state, depth, depth_inc, -INFINITY, INFINITY);
+		} else {
+			double kth = kth_score(moves, i, scores, exact);
+			value = search_root_move(new_board, &child_state, depth, depth_inc, kth, kth + 1);
+			is_exact = false;
+
+			if (!finished && value > kth) {
+				value = search_root_move(new_board, &child_state, depth, depth_inc, -INFINITY, INFINITY);
+				is_exact = true;
+			}
+		}
 
+		if (finished)
+			break;
+
+		scores[move] = value;
+		exact[move] = is_exact;
+		nr_exact += is_exact;
+	}
+}
+
+/**
+ * Keeps the line as the result of the search, and reports it unless the
+ * search is pondering. Nobody is interested in the progress of pondering.
+ */
+void Search::report(const search_info_t *info) {
+	if (info->multi_pv <= 1) {
+		last_result.move = info->pv_length > 0 ? info->pv[0] : -1;
+		last_result.info = *info;
+	}
+	if (info_callback && !infinite)
+		info_callback(info);
+}
+
+/**
+ * What the result of a search that stops early depends on, besides the board:
+ * the evaluator and the reductions. Never SOLVED_ANY_SETTINGS.
+ */
+uint32_t Search::solved_settings(void) const {
+	double settings[] = {(double) evaluator, (double) lmr_min_depth, (double) lmr_min_move, (double) lmr_endgame, lmr_base, lmr_divisor};
+	uint8_t bytes[sizeof(settings)];
+	memcpy(bytes, settings, sizeof(settings));
+
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (uint8_t byte : bytes)
+		hash = (hash ^ byte) * 16777619u;
+	return hash != SOLVED_ANY_SETTINGS ? hash : 1;
+}
+
+int8_t Search::run_search(void) {
+	board_t board = position;
 	uint64_t valid = get_valid_moves(board);
-#ifndef METRICS
-	nodes = 0;
-#endif
 
 	if (count(valid) == 1) {
-		for (uint8_t i = 0; i < 64; ++i) {
-			if (is_set(valid, i))
-				return i;
-		}
+		last_result.move = __builtin_ctzll(valid);
+		last_result.info.pv_length = 1;
+		last_result.info.pv[0] = last_result.move;
+		return last_result.move;
 	}
 
 #ifdef PARALLEL
@@ -287,47 +1000,277 @@ int8_t ai_turn(board_t board, uint64_t time_ms) {
 	// unnecessary depths in the late game
 	uint8_t moves_left = count(~(board.player | board.opponent));
 
-	for (uint8_t depth = START_DEPTH; !finished && depth < max_depth && depth <= moves_left; depth += depth_inc) {
-		debug_print("Max depth: %" PRIu8 "\n", depth);
+	// A position that was read out before at least as deep as this search
+	// can go is not searched again. Pondering has all the time in the world,
+	// so it searches anyway.
+	solved_entry_t solved;
+	uint8_t deepest = max_depth - 1 < moves_left ? max_depth - 1 : moves_left;
+	if (depth_limit > 0 && depth_limit < deepest)
+		deepest = depth_limit;
+	if (!infinite && find_solved(board, solved_settings(), &solved) && (solved.exact || solved.depth >= deepest)) {
+		search_info_t info;
+		info.depth = solved.depth;
+		info.multi_pv = 0;
+		info.score = solved.score;
+		info.upper_bound = false;
+		info.nodes = 0;
+		info.time_ms = get_time_ms() - start_time_ms;
+		info.ebf = 0;
+		info.pv_length = 1;
+		info.pv[0] = solved.move;
+		report(&info);
+		return solved.move;
+	}
 
-		for (uint8_t i = 0; !finished && i < 64; ++i) {
-			if (is_set(valid, i)) {
-				board_t new_board = {.player = board.player, .opponent = board.opponent};
-				do_move(&new_board, i);
+	eval_state_t state, child_state;
+	init_eval_state(&state, board, evaluator == PATTERN ? TRACK_PATTERNS : (evaluator == NNUE ? TRACK_NNUE : 0));
 
-				// We want the perspective of the other player in the recursive call
-				switch_boards(&new_board);
+	int8_t previous_best = -1;
+	long previous_iteration_ms = 0;
+	uint8_t completed_depth = 0;
+	double completed_score = 0;
+	uint64_t previous_iteration_nodes = 0;
 
-#ifdef PARALLEL
-#pragma omp parallel
-				for (uint8_t depth_delta = 0; !finished && depth_delta < depth_inc; depth_delta++)
-					negamax(new_board, depth + depth_delta, -INFINITY, INFINITY, 1);
-#else
-				negamax(new_board, depth, -INFINITY, INFINITY, 1);
+	// The root moves and their scores for MultiPV
+	uint8_t moves[64];
+	uint8_t nr_root_moves = 0;
+	double scores[64];
+	bool exact[64];
+	for (uint8_t i = 0; i < 64; ++i) {
+		scores[i] = -INFINITY;
+		if (is_set(valid, i))
+			moves[nr_root_moves++] = i;
+	}
+
+	for (uint8_t depth = START_DEPTH; !finished && depth < max_depth && depth <= moves_left && (depth_limit == 0 || depth <= depth_limit); depth += depth_inc) {
+		debug_print("Max depth: %" PRIu8 "\n", depth);
+		long iteration_start_ms = get_time_ms();
+		uint64_t iteration_start_nodes = count_nodes();
+#ifdef TRACE
+		trace_span(TRACE_ITERATION_BEGIN, depth, 0, &thread_stats[0]);
 #endif
+
+		if (multi_pv > 1) {
+			search_multi_pv(board, &state, moves, nr_root_moves, depth, depth_inc, scores, exact);
+		} else {
+			for (uint8_t i = 0; !finished && i < 64; ++i) {
+				if (is_set(valid, i)) {
+					board_t new_board = make_move(board, &state, i, &child_state, &thread_stats[0]);
+					search_root_move(new_board, &child_state, depth, depth_inc, -INFINITY, INFINITY);
+				}
 			}
 		}
+#ifdef TRACE
+		trace_span(TRACE_ITERATION_END, depth, 0, &thread_stats[0]);
+#endif
+
+		if (finished)
+			break;
 
-#ifdef METRICS
 		levels_evaluated += depth;
-		nr_moves++;
-#endif
+		nr_searches++;
+
+		long now_ms = get_time_ms();
+		long iteration_ms = now_ms - iteration_start_ms;
+
+		// A best move that is still changing is not to be trusted yet, so
+		// take some of the time that was kept in reserve
+		double score;
+		int8_t best = get_best_move(board, valid, &score);
+		if (!infinite && previous_best != -1 && best != previous_best) {
+			long extended_ms = soft_end_ms + soft_time_ms / 2;
+			soft_end_ms = extended_ms < end_time_ms ? extended_ms : (long) end_time_ms;
+		}
+		previous_best = best;
+		completed_depth = depth + depth_inc - 1;
+		completed_score = score;
+
+		// An iteration of the parallel search goes depth_inc depths deeper
+		uint64_t iteration_nodes = count_nodes() - iteration_start_nodes;
+		double ebf = 0;
+		if (previous_iteration_nodes > 0)
+			ebf = pow((double) iteration_nodes / previous_iteration_nodes, 1.0 / depth_inc);
+		previous_iteration_nodes = iteration_nodes;
+		if (last_stats.nr_iterations < STATS_DEPTHS) {
+			uint8_t i = last_stats.nr_iterations++;
+			last_stats.iteration_depth[i] = completed_depth;
+			last_stats.iteration_nodes[i] = iteration_nodes;
+			last_stats.iteration_ebf[i] = ebf;
+		}
+
+		{
+			search_info_t info;
+			info.depth = depth + depth_inc - 1;
+			info.nodes = count_nodes() - search_start_nodes;
+			info.time_ms = now_ms - start_time_ms;
+			info.ebf = ebf;
+
+			if (multi_pv > 1) {
+				// Every root move, ranked
+				sort_moves(moves, nr_root_moves, scores);
+				for (uint8_t i = 0; i < nr_root_moves; ++i) {
+					info.multi_pv = i + 1;
+					info.score = scores[moves[i]];
+					info.upper_bound = !exact[moves[i]];
+					info.pv_length = get_pv(board, moves[i], info.pv);
+					report(&info);
+				}
+			} else {
+				info.multi_pv = 0;
+				info.score = score;
+				info.upper_bound = false;
+				info.pv_length = get_pv(board, best, info.pv);
+				report(&info);
+			}
+		}
+
+		// Predict the next iteration from the growth of the previous ones. An
+		// iteration that is aborted halfway is wasted time.
+		double growth = 4;
+		if (previous_iteration_ms > 0)
+			growth = fmin(fmax((double) iteration_ms / previous_iteration_ms, 2), 8);
+		previous_iteration_ms = iteration_ms > 0 ? iteration_ms : 1;
+
+		if (now_ms >= soft_end_ms || now_ms + iteration_ms * growth > end_time_ms)
+			break;
 	}
 
 	// Retrieve the best move from the hashtable
-	int8_t best_move = get_best_move(board, valid);
+	int8_t best_move = get_best_move(board, valid, NULL);
+	last_result.move = best_move;
 
-	free_map();
+	// Reductions are off near the end of the game, so a search to the last
+	// move there is exact
+	bool solved_exactly = completed_depth >= moves_left && moves_left <= lmr_endgame;
+	if (completed_depth > 0 && finite_score(completed_score) && (solved_exactly || completed_depth >= solved_min_depth))
+		store_solved(board, best_move, completed_score, completed_depth, solved_exactly, solved_settings());
+
+	long used_ms = get_time_ms() - start_time_ms;
+	search_time_ms += used_ms;
+
+	// Keep track of how far we go past the deadline, the interface only
+	// allows for TIME_SAFETY_MS
+	long overshoot_ms = used_ms - hard_time_ms;
+	if (!infinite && (log_time || overshoot_ms > 0))
+		fprintf(stderr, "time used %ld planned %ld deadline %ld overshoot %ld\n", used_ms, (long) soft_time_ms, (long) hard_time_ms, overshoot_ms);
 
 	return best_move;
 }
 
-void print_ai_metrics(void) {
-#ifdef METRICS
+int8_t Search::run(const search_limits_t *limits) {
+	prepare(limits);
+	return run();
+}
+
+int8_t Search::run(void) {
+	search_result = run_search();
+	add_node_stats();
+	flush_trace();
+	return search_result;
+}
+
+void Search::start(const search_limits_t *limits) {
+	// The deadlines are set before the thread exists, so a ponderhit can not
+	// be overwritten by a thread that starts late
+	prepare(limits);
+	thread = std::thread([this]() {
+		run();
+	});
+}
+
+int8_t Search::wait(void) {
+	if (thread.joinable())
+		thread.join();
+	return search_result;
+}
+
+void Search::stop(void) {
+	finished = true;
+}
+
+void Search::ponderhit(const search_limits_t *limits) {
+	set_deadlines(position, limits);
+}
+
+int8_t Search::ponder_move(board_t board) {
+	board_eval_t eval;
+	if (!find_eval(table, board, evaluator, &eval) || !is_set(get_valid_moves(board), eval.best_move))
+		return -1;
+	return eval.best_move;
+}
+
+void Search::end(bool keep_table) {
+	if (table != &own_table)
+		return;
+	if (!keep_table)
+		clear_map(table);
+}
+
+search_result_t Search::result(void) const {
+	return last_result;
+}
+
+search_stats_t Search::stats(void) const {
+	search_stats_t stats = last_stats;
+	stats.time_ms = last_result.info.time_ms;
+	stats.depth = last_result.info.depth;
+	stats.table_entries = map_count(table);
+	stats.table_contended = table->contended;
+	stats.table_wait_ns = table->wait_ns;
+	return stats;
+}
+
+#ifdef PERF
+static const char *function_names[PERF_FUNCTIONS] = {
+	"get_valid_moves", "do_move", "evaluation", "find_eval", "store_eval"
+};
+
+/**
+ * The hardware counters of the searches: per node for the whole search, and
+ * per call for the sampled calls of the hot functions
+ */
+static void print_perf_metrics(const search_stats_t *stats) {
+	printf("PERF:\n");
+	const char *error = perf_error();
+	if (error != NULL) {
+		printf("    Counters unavailable: %s\n", error);
+		return;
+	}
+
+	const uint64_t *values = stats->perf.values;
+	double nodes = fmax(stats->nodes, 1);
+	if (perf_available(PERF_CYCLES) && perf_available(PERF_INSTRUCTIONS))
+		printf("    IPC: %.2f\n", (double) values[PERF_INSTRUCTIONS] / fmax(values[PERF_CYCLES], 1));
+	for (uint8_t event = 0; event < PERF_EVENTS; ++event) {
+		if (perf_available((perf_event_t) event))
+			printf("    %s/node: %.2f\n", perf_event_name((perf_event_t) event), values[event] / nodes);
+	}
+
+	printf("    Per call, 1 in %d calls measured:\n", PERF_SAMPLE_CALLS);
+	for (uint8_t function = 0; function < PERF_FUNCTIONS; ++function) {
+		double samples = fmax(stats->function_samples[function], 1);
+		printf("        %s: %" PRIu64 " calls", function_names[function], stats->function_calls[function]);
+		for (uint8_t event = 0; event < PERF_EVENTS; ++event) {
+			if (perf_available((perf_event_t) event))
+				printf(", %.2f %s", stats->function_perf[function].values[event] / samples, perf_event_name((perf_event_t) event));
+		}
+		printf("\n");
+	}
+}
+#endif
+
+void Search::print_metrics(void) const {
+	const search_stats_t *total = &total_stats;
+	uint64_t nodes = total->nodes;
+	uint64_t branches = total->branches;
+	uint64_t branches_evaluated = total->branches_evaluated;
+	uint64_t nodes_evaluated = total->nodes_evaluated;
+	uint64_t unique_nodes = total->unique_nodes;
+
 	printf("AI:\n");
 	printf("    Start Depth: %" PRIu8 "\n", START_DEPTH);
-	printf("    Average Reached Depth: %" PRIu64 "\n", levels_evaluated / nr_moves);
-	printf("    Nodes/s: %f\n", (double) nodes / ((double) nr_moves * (time_limit / 1000.0)));
+	printf("    Average Reached Depth: %" PRIu64 "\n", nr_searches > 0 ? levels_evaluated / nr_searches : 0);
+	printf("    Nodes/s: %f\n", (double) nodes / (search_time_ms / 1000.0));
 	printf("    Branches: %" PRIu64 "\n", branches);
 	printf("    Branches explored: %" PRIu64 "\n", branches_evaluated);
 	printf("    Branches pruned: %" PRIu64 "\n", branches - branches_evaluated);
@@ -337,5 +1280,149 @@ void print_ai_metrics(void) {
 	printf("    Nodes evaluated: %" PRIu64 "\n", nodes_evaluated);
 	printf("    Unique nodes evaluated: %" PRIu64 "\n", unique_nodes);
 	printf("    %% Unique nodes : %f\n", 100 * (double) unique_nodes / (double) nodes_evaluated);
+	printf("    LMR reductions: %" PRIu64 "\n", total->lmr_reduced);
+	printf("    LMR re-searches: %" PRIu64 "\n", total->lmr_researched);
+	printf("    Table hits: %" PRIu64 "\n", total->table_hits);
+	printf("    Table misses: %" PRIu64 "\n", total->table_misses);
+	printf("    %% Table hits: %f\n", 100.0 * total->table_hits / ((double) total->table_hits + total->table_misses));
+	printf("    Evaluation cache hits: %" PRIu64 "\n", total->cache_hits);
+	printf("    Evaluation cache misses: %" PRIu64 "\n", total->cache_misses);
+	printf("    %% Evaluation cache hits: %f\n", 100.0 * total->cache_hits / ((double) total->cache_hits + total->cache_misses));
+
+	printf("    Nodes by remaining depth (%% table miss/shallow/cutoff):\n");
+	for (uint8_t depth = 0; depth < STATS_DEPTHS; ++depth) {
+		const uint64_t *probes = total->probes[depth];
+		double nr_probes = fmax(probes[PROBE_MISS] + probes[PROBE_SHALLOW] + probes[PROBE_CUTOFF], 1);
+		if (total->depth_nodes[depth] > 0) {
+			printf("        %2" PRIu8 ": %" PRIu64 " (%.1f/%.1f/%.1f)\n", depth, total->depth_nodes[depth],
+					100 * probes[PROBE_MISS] / nr_probes, 100 * probes[PROBE_SHALLOW] / nr_probes, 100 * probes[PROBE_CUTOFF] / nr_probes);
+		}
+	}
+
+	uint64_t cutoffs = 0;
+	for (uint8_t move = 0; move < STATS_MOVES; ++move)
+		cutoffs += total->cutoffs[move];
+	printf("    Beta cutoffs by move index:\n");
+	for (uint8_t move = 0; move < STATS_MOVES; ++move) {
+		if (total->cutoffs[move] > 0)
+			printf("        %2" PRIu8 ": %" PRIu64 " (%.1f%%)\n", move, total->cutoffs[move], 100.0 * total->cutoffs[move] / cutoffs);
+	}
+
+	printf("    Effective branching factor of the last search:\n");
+	for (uint8_t i = 0; i < last_stats.nr_iterations; ++i) {
+		printf("        depth %2" PRIu8 ": %" PRIu64 " nodes, %.2f\n", last_stats.iteration_depth[i],
+				last_stats.iteration_nodes[i], last_stats.iteration_ebf[i]);
+	}
+
+#ifdef PERF
+	print_perf_metrics(total);
 #endif
+
+	print_hash_metrics(table);
+}
+
+void set_max_depth(uint8_t depth) {
+	default_search.set_max_depth(depth);
+}
+
+void set_multi_pv(uint8_t moves) {
+	default_search.set_multi_pv(moves);
+}
+
+void set_solved_min_depth(uint8_t depth) {
+	default_search.set_solved_min_depth(depth);
+}
+
+bool set_evaluator(evaluator_t evaluator) {
+	return default_search.set_evaluator(evaluator);
+}
+
+double evaluation(board_t board) {
+	return default_search.evaluation(board);
+}
+
+void set_lmr_min_depth(uint8_t depth) {
+	default_search.set_lmr_min_depth(depth);
+}
+
+void set_lmr_min_move(uint8_t move) {
+	default_search.set_lmr_min_move(move);
+}
+
+void set_lmr_endgame(uint8_t empties) {
+	default_search.set_lmr_endgame(empties);
+}
+
+void set_lmr_base(double base) {
+	default_search.set_lmr_base(base);
+}
+
+void set_lmr_divisor(double divisor) {
+	default_search.set_lmr_divisor(divisor);
+}
+
+double negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player) {
+	return default_search.negamax(board, state, depth, alpha, beta, player);
+}
+
+int8_t ai_search(board_t board, const search_limits_t *limits) {
+	default_search.set_position(board);
+	return default_search.run(limits);
+}
+
+void start_search(board_t board, const search_limits_t *limits) {
+	default_search.set_position(board);
+	default_search.start(limits);
+}
+
+int8_t wait_search(void) {
+	return default_search.wait();
+}
+
+void stop_search(void) {
+	default_search.stop();
+}
+
+void set_hash(size_t size_mb) {
+	default_search.set_hash(size_mb);
+}
+
+bool set_trace_file(const char *path) {
+	return default_search.set_trace_file(path);
+}
+
+void set_info_callback(void (*callback)(const search_info_t *info)) {
+	if (callback != NULL)
+		default_search.set_info_callback(callback);
+	else
+		default_search.set_info_callback(nullptr);
+}
+
+void ponderhit(const search_limits_t *limits) {
+	default_search.ponderhit(limits);
+}
+
+int8_t ponder_move(board_t board) {
+	return default_search.ponder_move(board);
+}
+
+void end_search(bool keep_table) {
+	default_search.end(keep_table);
+}
+
+int8_t ai_turn(board_t board, uint64_t time_ms) {
+	search_limits_t limits = {.move_time_ms = time_ms, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+	int8_t best_move = ai_search(board, &limits);
+	end_search(false);
+	return best_move;
+}
+
+void print_ai_metrics(void) {
+	default_search.print_metrics();
+}
+
+bool finite_score(double score) {
+	uint64_t bits;
+	memcpy(&bits, &score, sizeof(bits));
+	return ((bits >> 52) & 0x7ff) != 0x7ff;
 }
@@ -1,27 +1,437 @@
 #ifndef AI_H
 #define AI_H
 
+#include <atomic>
+#include <functional>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <thread>
+#include <vector>
 
+#include "../lib/eval_hashmap.hpp"
+#include "../lib/perf_counters.hpp"
 #include "../lib/state_t.hpp"
+#include "../lib/trace.hpp"
+#include "evaluation.hpp"
+
+typedef enum {
+	CLASSIC, PATTERN, NNUE
+} evaluator_t;
+
+/**
+ * How long a search may take. Either a fixed time per move, or the state of
+ * the game clock of the player to move, from which the time for this move is
+ * planned. A search with a depth or node limit, but without a time or a
+ * clock, has no deadline at all.
+ */
+typedef struct {
+	uint64_t move_time_ms;    // Fixed time for this move, 0 to use the clock
+	uint64_t remaining_ms;    // Time left on the clock
+	uint64_t increment_ms;    // Time added to the clock after every move
+	uint8_t moves_to_go;      // Moves until the next time control, 0 if none
+	uint64_t max_nodes;       // Stop after this many nodes, 0 for no limit
+	uint8_t max_depth;        // Stop after this depth, 0 for no limit
+	bool infinite;            // Search until stopped or until ponderhit
+} search_limits_t;
+
+/**
+ * The state of the search after a completed iteration
+ */
+typedef struct {
+	uint8_t depth;
+	uint8_t multi_pv;         // Rank of the move with MultiPV, 0 otherwise
+	double score;             // From the perspective of the player to move
+	bool upper_bound;         // The score is at most this, not exactly this
+	uint64_t nodes;
+	uint64_t time_ms;
+	double ebf;               // Effective branching factor, 0 for the first iteration
+	uint8_t pv_length;
+	uint8_t pv[64];           // The principal variation, as coordinates
+} search_info_t;
+
+/**
+ * What a search leaves behind. The result is the best line of the last
+ * completed iteration, so the move is info.pv[0] unless pv_length is 0.
+ */
+typedef struct {
+	int8_t move;              // -1 if there was nothing to search
+	search_info_t info;
+} search_result_t;
+
+// The histograms count by the remaining depth of a node, or by the index of a
+// move in the ordered list of moves
+#define STATS_DEPTHS 64
+#define STATS_MOVES 64
+
+typedef enum {
+	PROBE_MISS,               // The board is not in the table
+	PROBE_SHALLOW,            // Too shallow, or a bound inside the window, only its best move is of use
+	PROBE_CUTOFF,             // Deep enough to return its value
+	PROBE_OUTCOMES
+} probe_outcome_t;
+
+// The hot functions of the search, of which builds with PERF measure a sample
+// of the calls with the hardware counters
+typedef enum {
+	PERF_VALID_MOVES,         // get_valid_moves
+	PERF_DO_MOVE,             // do_move, with the update of the evaluation state
+	PERF_EVALUATION,          // The evaluation at the leaves, with its cache
+	PERF_FIND_EVAL,           // find_eval, the table lookups
+	PERF_STORE_EVAL,          // store_eval, the table stores
+	PERF_FUNCTIONS
+} perf_function_t;
+
+/**
+ * What negamax counts. Every thread of a search counts in a copy of its own,
+ * which starts on a cache line of its own, so the threads never write to the
+ * same line. The copies are added up after the search.
+ */
+typedef struct alignas(64) {
+	uint64_t nodes;
+	uint64_t branches;
+	uint64_t branches_evaluated;
+	uint64_t nodes_evaluated;
+	uint64_t unique_nodes;
+	uint64_t lmr_reduced;
+	uint64_t lmr_researched;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t cutoffs[STATS_MOVES];
+	uint64_t probes[STATS_DEPTHS][PROBE_OUTCOMES];
+	perf_counts_t perf;
+	uint64_t function_calls[PERF_FUNCTIONS];
+	uint64_t function_samples[PERF_FUNCTIONS];
+	perf_counts_t function_perf[PERF_FUNCTIONS];
+	trace_buffer_t *trace;    // Of the thread, in builds with TRACE
+	trace_record_t *trace_node; // The node it is in
+} node_stats_t;
+
+/**
+ * Counters of the last search and of the table it used. The waits for the
+ * lock of the table are only counted in builds with METRICS, the hardware
+ * counters only in builds with PERF.
+ */
+typedef struct {
+	uint64_t nodes;
+	uint64_t time_ms;
+	uint8_t depth;            // Deepest completed iteration
+	uint64_t table_entries;
+	uint64_t table_hits;
+	uint64_t table_misses;
+	uint64_t table_contended; // Waits for the lock of the table
+	uint64_t table_wait_ns;
+	uint64_t branches;
+	uint64_t branches_evaluated;
+	uint64_t nodes_evaluated;
+	uint64_t unique_nodes;
+	uint64_t lmr_reduced;
+	uint64_t lmr_researched;
+	uint64_t cache_hits;      // Of the evaluation cache
+	uint64_t cache_misses;
+	uint64_t depth_nodes[STATS_DEPTHS];             // Nodes by remaining depth, that were not aborted
+	uint64_t cutoffs[STATS_MOVES];                  // Beta cutoffs by the index of their move
+	uint64_t probes[STATS_DEPTHS][PROBE_OUTCOMES];  // Table probes by remaining depth
+	uint8_t nr_iterations;
+	uint8_t iteration_depth[STATS_DEPTHS];
+	uint64_t iteration_nodes[STATS_DEPTHS];         // Nodes of every completed iteration
+	double iteration_ebf[STATS_DEPTHS];             // Effective branching factor of every iteration
+	perf_counts_t perf;                             // Of all threads, while they searched
+	uint64_t function_calls[PERF_FUNCTIONS];
+	uint64_t function_samples[PERF_FUNCTIONS];      // Calls that were measured
+	perf_counts_t function_perf[PERF_FUNCTIONS];    // Of the measured calls
+} search_stats_t;
+
+/**
+ * A search with everything it needs of its own: its transposition table, its
+ * limits, its settings and its statistics. Searches only share the evaluation
+ * weights, the evaluation cache and the solved position log, so any number of
+ * them can run in one process, each on a thread of its own.
+ *
+ * The methods do what the free functions of the same names below do. Those
+ * work on a default search of the process.
+ */
+class Search {
+public:
+	Search();
+	~Search();
+
+	Search(const Search &) = delete;
+	Search &operator=(const Search &) = delete;
+
+	void set_max_depth(uint8_t depth);
+	void set_multi_pv(uint8_t moves);
+	void set_solved_min_depth(uint8_t depth);
+	bool set_evaluator(evaluator_t evaluator);
+	void set_lmr_min_depth(uint8_t depth);
+	void set_lmr_min_move(uint8_t move);
+	void set_lmr_endgame(uint8_t empties);
+	void set_lmr_base(double base);
+	void set_lmr_divisor(double divisor);
+	void set_info_callback(std::function<void(const search_info_t *info)> callback);
+	bool set_trace_file(const char *path);
+	void set_hash(size_t size_mb);
+
+	/**
+	 * Makes the search use a table it shares with other searches, or its own
+	 * table again with NULL. The owner of a shared table initialises it,
+	 * marked as shared, and clears it while no search uses it, end leaves it
+	 * alone.
+	 */
+	void set_table(eval_map_t *shared_table);
+
+	/**
+	 * Sets the board that run and start search
+	 */
+	void set_position(board_t board);
+
+	/**
+	 * Searches the position on the calling thread
+	 *
+	 * @return The coordinate of the best move
+	 */
+	int8_t run(const search_limits_t *limits);
+
+	/**
+	 * Sets up a search with the limits and starts its clock, without
+	 * searching. run without limits then searches on the calling thread. A
+	 * stop in between stops that search.
+	 */
+	void prepare(const search_limits_t *limits);
+	int8_t run(void);
+
+	void start(const search_limits_t *limits);
+	int8_t wait(void);
+	void stop(void);
+	void ponderhit(const search_limits_t *limits);
+	int8_t ponder_move(board_t board);
+	void end(bool keep_table);
+
+	search_result_t result(void) const;
+	search_stats_t stats(void) const;
+	void print_metrics(void) const;
+
+	double evaluation(board_t board) const;
+	double negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player);
+
+private:
+	double negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player, node_stats_t *stats);
+	double negamax_node(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player, node_stats_t *stats);
+	uint64_t count_nodes(void) const;
+	void add_node_stats(void);
+	void init_lmr_table(void);
+	double leaf_evaluation(board_t board, const eval_state_t *state, node_stats_t *stats);
+	int8_t get_best_move(board_t board, uint64_t valid, double *value);
+	uint8_t get_pv(board_t board, uint8_t move, uint8_t *pv);
+	bool find_board(board_t board, int8_t player, board_eval_t *eval);
+	bool store_board(board_t board, int8_t player, double *value, uint8_t depth, uint8_t bound, uint8_t best_move);
+	void prefetch_board(board_t board, int8_t player) const;
+	void set_deadlines(board_t board, const search_limits_t *limits);
+	double search_root_move(board_t new_board, const eval_state_t *child_state, uint8_t depth, uint8_t depth_inc, double alpha, double beta);
+	double search_root_thread(board_t new_board, const eval_state_t *child_state, uint8_t depth, uint8_t depth_inc, double alpha, double beta, node_stats_t *stats);
+	double kth_score(const uint8_t *moves, uint8_t nr_moves, const double *scores, const bool *exact) const;
+	void search_multi_pv(board_t board, const eval_state_t *state, uint8_t *moves, uint8_t nr_moves, uint8_t depth, uint8_t depth_inc, double *scores, bool *exact);
+	void report(const search_info_t *info);
+	uint32_t solved_settings(void) const;
+	int8_t run_search(void);
+	void trace_span(trace_kind_t kind, uint8_t depth, uint8_t move, node_stats_t *stats);
+	void flush_trace(void);
+
+	eval_map_t own_table;
+	eval_map_t *table;
+	board_t position;
+
+	uint8_t max_depth;
+	uint8_t multi_pv;
+	uint8_t solved_min_depth;
+	evaluator_t evaluator;
+	std::function<void(const search_info_t *info)> info_callback;
+
+	// Late move reductions. Moves at or past lmr_min_move in the ordered list
+	// are searched with the reduction from lmr_table[depth][move index] first,
+	// and only re-searched at full depth when they beat alpha.
+	uint8_t lmr_min_depth;
+	uint8_t lmr_min_move;
+	uint8_t lmr_endgame;
+	double lmr_base;
+	double lmr_divisor;
+	uint8_t lmr_table[64][64];
+
+	// The deadlines are moved by ponderhit while the search runs on its own thread
+	std::atomic<long> start_time_ms;
+	std::atomic<long> soft_time_ms;
+	std::atomic<long> hard_time_ms;
+	std::atomic<long> soft_end_ms;
+	std::atomic<long> end_time_ms;
+	std::atomic<bool> infinite;
+	std::atomic<bool> log_time;
+	std::atomic<bool> finished;
+
+	std::thread thread;
+	int8_t search_result;
+	search_result_t last_result;
+	uint64_t search_start_nodes;
+	uint64_t node_limit;
+	uint8_t depth_limit;
+	uint64_t search_time_ms;
+	uint64_t levels_evaluated;
+	uint64_t nr_searches;
+
+	// The counters of every thread of the running search, those of the last
+	// search, and those of all searches together
+	std::vector<node_stats_t> thread_stats;
+	search_stats_t last_stats;
+	search_stats_t total_stats;
+
+	// The ring buffers of the threads, written to the trace file after every
+	// search, in builds with TRACE
+	std::vector<trace_buffer_t> trace_buffers;
+	FILE *trace_file;
+	uint64_t trace_start_ns;
+};
 
 void set_max_depth(uint8_t depth);
 
+/**
+ * The number of root moves to get exact scores for. With more than one, every
+ * root move is reported after every iteration: the best ones with exact
+ * scores, the others with upper bounds from null window searches.
+ */
+void set_multi_pv(uint8_t moves);
+
+/**
+ * The depth a search has to complete before its result is written to the
+ * solved position log (see solved.hpp). Searches to the end of the game are
+ * always written.
+ */
+void set_solved_min_depth(uint8_t depth);
+
+/**
+ * Selects the evaluation function used at the leaves of the search
+ *
+ * @return False if the evaluator can not be used, for instance because no
+ * pattern weights have been loaded
+ */
+bool set_evaluator(evaluator_t evaluator);
+
+/**
+ * Sets the size of the transposition table in MB, rounded down to a power of
+ * two, DEFAULT_HASH_MB (see eval_hashmap.hpp) by default. The table is
+ * allocated at its new size by the next search, without the boards it had.
+ */
+void set_hash(size_t size_mb);
+
+/**
+ * Appends a trace of every following search to the file (see trace.hpp), or
+ * stops tracing with NULL
+ *
+ * @return False if the file can not be opened, or the engine was built
+ * without TRACE
+ */
+bool set_trace_file(const char *path);
+
+/**
+ * Static evaluation of the board from the perspective of the player to move
+ */
+double evaluation(board_t board);
+
+/**
+ * Late move reduction settings. Moves at index min_move or later in the
+ * ordered move list are searched at a reduced depth first, but only at nodes
+ * with at least min_depth plies left and more than endgame empty squares.
+ * The reduction for a depth and move index is
+ * base + ln(depth) * ln(move index) / divisor, rounded down.
+ */
+void set_lmr_min_depth(uint8_t depth);
+void set_lmr_min_move(uint8_t move);
+void set_lmr_endgame(uint8_t empties);
+void set_lmr_base(double base);
+void set_lmr_divisor(double divisor);
+
 /**
  * Performs negamax on the provided board. Negamax is an algorithm that 
  *
  * @param board
+ * @param state - the incremental evaluation state of the board
  * @param depth
  * @param alpha
  * @param beta
  * @param player -  the current player to consider. 1 is the player, -1 is the opponent
  * @return
  */
-double negamax(board_t board, uint64_t depth, double alpha, double beta, int8_t player);
+double negamax(board_t board, const eval_state_t *state, uint64_t depth, double alpha, double beta, int8_t player);
+
+/**
+ * Searches the board for the best move within the limits. With a game clock,
+ * the search stops on a soft deadline that is extended while the best move
+ * keeps changing, and does not start an iteration it can not finish.
+ *
+ * @param board
+ * @param limits
+ * @return The coordinate of the best move
+ */
+int8_t ai_search(board_t board, const search_limits_t *limits);
+
+/**
+ * Starts the same search as ai_search on a thread of its own, and returns
+ * right away
+ */
+void start_search(board_t board, const search_limits_t *limits);
+
+/**
+ * Waits for the search started by start_search to finish
+ *
+ * @return The coordinate of the best move
+ */
+int8_t wait_search(void);
+
+/**
+ * Makes the running search finish as soon as possible
+ */
+void stop_search(void);
+
+/**
+ * Sets a function that is called after every completed iteration, on the
+ * thread that runs the search. NULL disables it.
+ */
+void set_info_callback(void (*callback)(const search_info_t *info));
+
+/**
+ * Turns the running (infinite) ponder search into the real search with the
+ * given limits, keeping everything it found so far. The time for the move
+ * starts counting now.
+ */
+void ponderhit(const search_limits_t *limits);
+
+/**
+ * The move the last search expects for the player to move on the board, which
+ * is the board after our own move, from the perspective of the opponent
+ *
+ * @return The coordinate of the move, or -1 if the search has no expectation
+ */
+int8_t ponder_move(board_t board);
+
+/**
+ * Ends the use of the transposition table of the last search. The table keeps
+ * its size, only its boards are forgotten.
+ *
+ * @param keep_table - keep the boards for the next search
+ */
+void end_search(bool keep_table);
 
+/**
+ * Searches the board for the best move for a fixed amount of time, and
+ * releases the transposition table afterwards
+ */
 int8_t ai_turn(board_t board, uint64_t time_ms);
 
 void print_ai_metrics();
 
+/**
+ * Whether a score is finite. Scores are only infinite when there was no move
+ * to score, because the player to move has to pass. The engine is built with -ffast-math, which assumes that isfinite is
+ * always true, so this looks at the bits of the score.
+ */
+bool finite_score(double score);
+
 #endif
@@ -0,0 +1,120 @@
+#include "book.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/mapped_file.hpp"
+
+static_assert(sizeof(book_entry_t) == 32, "Book entries are stored as they are in memory");
+
+static mapped_file_t book_file = {NULL, 0};
+static const book_entry_t *entries = NULL;
+static uint32_t nr_entries = 0;
+
+static int compare_entries(const void *a, const void *b) {
+	const book_entry_t *x = (const book_entry_t *) a;
+	const book_entry_t *y = (const book_entry_t *) b;
+
+	if (x->player != y->player)
+		return x->player < y->player ? -1 : 1;
+	if (x->opponent != y->opponent)
+		return x->opponent < y->opponent ? -1 : 1;
+	return 0;
+}
+
+bool load_book(const char *path) {
+	mapped_file_t file;
+	if (!map_file(path, &file))
+		return false;
+
+	const book_header_t *header = (const book_header_t *) file.data;
+	if (file.size < sizeof(*header)
+			|| strncmp(header->magic, BOOK_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != BOOK_VERSION
+			|| file.size != sizeof(*header) + (size_t) header->entries * sizeof(book_entry_t)) {
+		fprintf(stderr, "ERROR: %s is not a valid opening book\n", path);
+		unmap_file(&file);
+		return false;
+	}
+
+	unload_book();
+	book_file = file;
+	entries = (const book_entry_t *) (header + 1);
+	nr_entries = header->entries;
+	return true;
+}
+
+void unload_book(void) {
+	unmap_file(&book_file);
+	entries = NULL;
+	nr_entries = 0;
+}
+
+bool book_loaded(void) {
+	return entries != NULL;
+}
+
+const book_entry_t *book_entries(uint32_t *nr_book) {
+	*nr_book = nr_entries;
+	return entries;
+}
+
+const book_entry_t *find_book_entry(board_t board, uint8_t *symmetry) {
+	if (entries == NULL)
+		return NULL;
+
+	book_entry_t key;
+	board_t canonical = canonical_board(board, symmetry);
+	key.player = canonical.player;
+	key.opponent = canonical.opponent;
+
+	return (const book_entry_t *) bsearch(&key, entries, nr_entries, sizeof(book_entry_t), compare_entries);
+}
+
+int8_t book_move(board_t board) {
+	uint8_t symmetry;
+	const book_entry_t *entry = find_book_entry(board, &symmetry);
+	if (entry == NULL || entry->move == BOOK_NO_MOVE)
+		return -1;
+
+	// The move is stored on the canonical board, find the move on our board
+	// that ends up on the same square
+	uint64_t valid = get_valid_moves(board);
+	for (uint8_t i = 0; i < 64; ++i) {
+		if (is_set(valid, i) && transform_square(i, symmetry) == entry->move)
+			return i;
+	}
+	return -1;
+}
+
+bool write_book(const char *path, book_entry_t *book, uint32_t nr_book) {
+	qsort(book, nr_book, sizeof(book_entry_t), compare_entries);
+
+	size_t length = strlen(path);
+	char *tmp_path = (char *) malloc(length + 5);
+	memcpy(tmp_path, path, length);
+	memcpy(tmp_path + length, ".tmp", 5);
+
+	FILE *file = fopen(tmp_path, "wb");
+	if (file == NULL) {
+		free(tmp_path);
+		return false;
+	}
+
+	book_header_t header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+	header.version = BOOK_VERSION;
+	header.entries = nr_book;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& (nr_book == 0 || fwrite(book, sizeof(book_entry_t), nr_book, file) == nr_book);
+	ok = fclose(file) == 0 && ok;
+	ok = ok && rename(tmp_path, path) == 0;
+
+	if (!ok)
+		remove(tmp_path);
+	free(tmp_path);
+	return ok;
+}
@@ -0,0 +1,82 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../lib/state_t.hpp"
+
+/**
+ * Opening book. The book is a file of canonical positions (see
+ * canonical_board), sorted on the player and then the opponent, so a position
+ * is found with a binary search in the mapped file without loading anything.
+ * Every position holds the best move found by a deep search, its score and
+ * how the position fared in imported games.
+ */
+
+#define BOOK_MAGIC "OOOOBOK"
+#define BOOK_VERSION 1
+
+// The move of a position that has not been searched yet
+#define BOOK_NO_MOVE 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t entries;
+} book_header_t;
+
+typedef struct {
+	uint64_t player;     // The canonical board, the player is to move
+	uint64_t opponent;
+	int32_t score;       // Score of the best move for the player to move
+	uint32_t games;      // Imported games that reached the position
+	uint32_t wins;       // Of which the player to move won
+	uint8_t move;        // Best move on the canonical board, or BOOK_NO_MOVE
+	uint8_t depth;       // Depth of the search, 0 if not searched
+	uint8_t reserved[2];
+} book_entry_t;
+
+/**
+ * Maps the book at the given path, replacing the current book
+ *
+ * @return Whether the file is a valid book
+ */
+bool load_book(const char *path);
+void unload_book(void);
+bool book_loaded(void);
+
+/**
+ * All entries of the book, sorted
+ *
+ * @param[out] The number of entries
+ */
+const book_entry_t *book_entries(uint32_t *nr_book);
+
+/**
+ * Looks up the board in the book
+ *
+ * @param[in] The board, in any orientation
+ * @param[out] The symmetry from the board to the canonical board in the book, may be NULL
+ * @return The entry, or NULL if the position is not in the book
+ */
+const book_entry_t *find_book_entry(board_t board, uint8_t *symmetry);
+
+/**
+ * The best move on the board according to the book
+ *
+ * @return The coordinate of the move, or -1 if the book has no move for the board
+ */
+int8_t book_move(board_t board);
+
+/**
+ * Sorts the entries and writes them as a book. The book is written to a
+ * temporary file first and then renamed, so a book that is in use or that is
+ * being grown is never left half written.
+ *
+ * @return Whether the book was written
+ */
+bool write_book(const char *path, book_entry_t *entries, uint32_t nr_entries);
+
+#endif
@@ -0,0 +1,190 @@
+#include "evaluation.hpp"
+
+#include <stddef.h>
+#include <string.h>
+
+// Both implementations have to round identically, which fused multiply-adds
+// would break depending on how the compiler happened to schedule each of them
+#pragma GCC optimize ("no-fast-math", "fp-contract=off")
+
+static constexpr int8_t weights[64] = {
+	20, -3, 11, 8, 8, 11, -3, 20,
+	-3, -7, -4, 1, 1, -4, -7, -3,
+	11, -4, 2, 2, 2, 2, -4, 11,
+	8, 1, 2, -3, -3, 2, 1, 8,
+	8, 1, 2, -3, -3, 2, 1, 8,
+	11, -4, 2, 2, 2, 2, -4, 11,
+	-3, -7, -4, 1, 1, -4, -7, -3,
+	20, -3, 11, 8, 8, 11, -3, 20};
+
+static constexpr uint64_t weight_mask(int8_t value) {
+	uint64_t mask = 0;
+	for (uint8_t i = 0; i < 64; ++i)
+		if (weights[i] == value)
+			mask |= (uint64_t) 1 << i;
+	return mask;
+}
+
+// The squares grouped by their weight, so the weighted sum is a popcount per
+// group instead of a lookup per square
+#define WEIGHT_CLASSES 8
+static constexpr int8_t weight_values[WEIGHT_CLASSES] = {20, 11, 8, 2, 1, -3, -4, -7};
+static constexpr uint64_t weight_masks[WEIGHT_CLASSES] = {
+	weight_mask(20), weight_mask(11), weight_mask(8), weight_mask(2),
+	weight_mask(1), weight_mask(-3), weight_mask(-4), weight_mask(-7)
+};
+static_assert((weight_masks[0] | weight_masks[1] | weight_masks[2] | weight_masks[3]
+		| weight_masks[4] | weight_masks[5] | weight_masks[6] | weight_masks[7]) == ~(uint64_t) 0,
+		"Every square must be in a weight class");
+
+#define CORNERS 0x8100000000000081ULL
+
+/**
+ * 100 * mine / (mine + theirs) with the sign of whoever has more, and 0 on a
+ * tie. The numerator is chosen without branching, and the same operations as
+ * in the reference are done so the results are bit for bit the same.
+ */
+static double relative(double mine, double theirs) {
+	double numerator = mine > theirs ? mine : (mine < theirs ? -theirs : 0);
+	double total = mine + theirs;
+	return (100.0 * numerator) / (total > 0 ? total : 1);
+}
+
+static int32_t weighted_sum(uint64_t squares) {
+	int32_t sum = 0;
+	for (uint8_t i = 0; i < WEIGHT_CLASSES; ++i)
+		sum += weight_values[i] * count(squares & weight_masks[i]);
+	return sum;
+}
+
+void init_eval_state(eval_state_t *state, board_t board, uint8_t tracked) {
+	state->side = 0;
+	state->weight_score[0] = weighted_sum(board.player);
+	state->weight_score[1] = weighted_sum(board.opponent);
+	state->discs[0] = count(board.player);
+	state->discs[1] = count(board.opponent);
+	state->corners[0] = count(board.player & CORNERS);
+	state->corners[1] = count(board.opponent & CORNERS);
+
+	state->tracked = tracked;
+	if (tracked & TRACK_NNUE)
+		refresh_accumulators(board, state->accumulators[0], state->accumulators[1]);
+	if (tracked & TRACK_PATTERNS) {
+		pattern_indices(board, state->pattern_indices[0]);
+		switch_boards(&board);
+		pattern_indices(board, state->pattern_indices[1]);
+	}
+}
+
+void copy_eval_state(eval_state_t *destination, const eval_state_t *source) {
+	memcpy(destination, source, offsetof(eval_state_t, pattern_indices));
+	if (source->tracked & TRACK_PATTERNS)
+		memcpy(destination->pattern_indices, source->pattern_indices, sizeof(source->pattern_indices));
+	if (source->tracked & TRACK_NNUE)
+		memcpy(destination->accumulators, source->accumulators, sizeof(source->accumulators));
+}
+
+void update_eval_state(eval_state_t *state, uint8_t coordinate, uint64_t flipped) {
+	uint8_t mover = state->side;
+	uint8_t other = mover ^ 1;
+
+	// Only a handful of discs flip on a move, summing their weights one by
+	// one beats a popcount for every weight class
+	int32_t flipped_weight = 0;
+	for (uint64_t f = flipped; f != 0; f &= f - 1)
+		flipped_weight += weights[__builtin_ctzll(f)];
+	uint8_t flipped_discs = count(flipped);
+	uint8_t flipped_corners = count(flipped & CORNERS);
+
+	state->weight_score[mover] += weights[coordinate] + flipped_weight;
+	state->weight_score[other] -= flipped_weight;
+	state->discs[mover] += 1 + flipped_discs;
+	state->discs[other] -= flipped_discs;
+	state->corners[mover] += ((CORNERS >> coordinate) & 1) + flipped_corners;
+	state->corners[other] -= flipped_corners;
+
+	if (state->tracked & TRACK_PATTERNS)
+		update_pattern_indices(state->pattern_indices[mover], state->pattern_indices[other], coordinate, flipped);
+	if (state->tracked & TRACK_NNUE)
+		update_accumulators(state->accumulators[mover], state->accumulators[other], coordinate, flipped);
+
+	state->side = other;
+}
+
+void switch_eval_state(eval_state_t *state) {
+	state->side ^= 1;
+}
+
+double classic_evaluation(board_t board) {
+	int32_t weight_score = weighted_sum(board.player) - weighted_sum(board.opponent);
+
+	double a = relative(count(board.player), count(board.opponent));
+	double b = 25 * ((double) count(board.player & CORNERS) - (double) count(board.opponent & CORNERS));
+
+	uint64_t player_moves, opponent_moves;
+	get_both_valid_moves(board, &player_moves, &opponent_moves);
+	double c = relative(count(player_moves), count(opponent_moves));
+
+	return (10 * a) + (801.724 * b) + (78.922 * c) + (10 * (double) weight_score);
+}
+
+double classic_evaluation_state(board_t board, const eval_state_t *state) {
+	uint8_t me = state->side;
+	uint8_t them = me ^ 1;
+
+	int32_t weight_score = state->weight_score[me] - state->weight_score[them];
+	double a = relative(state->discs[me], state->discs[them]);
+	double b = 25 * ((double) state->corners[me] - (double) state->corners[them]);
+
+	uint64_t player_moves, opponent_moves;
+	get_both_valid_moves(board, &player_moves, &opponent_moves);
+	double c = relative(count(player_moves), count(opponent_moves));
+
+	return (10 * a) + (801.724 * b) + (78.922 * c) + (10 * (double) weight_score);
+}
+
+double reference_evaluation(board_t board) {
+	double a, b, c;
+	double my_discs = 0;
+	double opp_discs = 0;
+	double weight_score = 0;
+
+	for (int i = 0; i < 64; ++i) {
+		if (is_set(board.player, i)) {
+			weight_score += weights[i];
+			my_discs++;
+		} else if (is_set(board.opponent, i)) {
+			weight_score -= weights[i];
+			opp_discs++;
+		}
+	}
+	if (my_discs > opp_discs)
+		a = (100.0 * my_discs) / (my_discs + opp_discs);
+	else if (my_discs < opp_discs)
+		a = -(100.0 * opp_discs) / (my_discs + opp_discs);
+	else a = 0;
+
+	my_discs = opp_discs = 0;
+	if (is_set(board.player, 0)) my_discs++;
+	else if (is_set(board.opponent, 0)) opp_discs++;
+	if (is_set(board.player, 7)) my_discs++;
+	else if (is_set(board.opponent, 7)) opp_discs++;
+	if (is_set(board.player, 56)) my_discs++;
+	else if (is_set(board.opponent, 56)) opp_discs++;
+	if (is_set(board.player, 63)) my_discs++;
+	else if (is_set(board.opponent, 63)) opp_discs++;
+	b = 25 * (my_discs - opp_discs);
+
+	uint8_t player_mob = count(get_valid_moves(board));
+	switch_boards(&board);
+	uint8_t opponent_mob = count(get_valid_moves(board));
+	switch_boards(&board);
+
+	if (player_mob > opponent_mob)
+		c = (100.0 * player_mob) / (player_mob + opponent_mob);
+	else if (player_mob < opponent_mob)
+		c = -(100.0 * opponent_mob) / (player_mob + opponent_mob);
+	else c = 0;
+
+	return (10 * a) + (801.724 * b) + (78.922 * c) + (10 * weight_score);
+}
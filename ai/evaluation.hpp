@@ -0,0 +1,80 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include "../lib/state_t.hpp"
+#include "nnue.hpp"
+#include "patterns.hpp"
+
+/**
+ * Which of the optional parts of the evaluation state are tracked
+ */
+#define TRACK_PATTERNS 1
+#define TRACK_NNUE 2
+
+/**
+ * The parts of the evaluation that can be updated incrementally, carried down
+ * the search instead of being recomputed at every leaf. Every value is kept
+ * for both colours, side is the colour of the player to move. The search
+ * copies the state into each child, so undoing a move is free.
+ */
+typedef struct {
+	int32_t weight_score[2];
+	uint8_t discs[2];
+	uint8_t corners[2];
+	uint8_t side;
+	uint8_t tracked;
+	uint16_t pattern_indices[2][PATTERN_INSTANCES];
+	alignas(32) int16_t accumulators[2][NNUE_HIDDEN];
+} eval_state_t;
+
+/**
+ * Computes the state of a board from scratch
+ *
+ * @param[out] The state
+ * @param[in] The board, from the perspective of the player to move
+ * @param[in] The optional parts to track, TRACK_PATTERNS and TRACK_NNUE
+ */
+void init_eval_state(eval_state_t *state, board_t board, uint8_t tracked);
+
+/**
+ * Copies a state, skipping the parts that are not tracked
+ */
+void copy_eval_state(eval_state_t *destination, const eval_state_t *source);
+
+/**
+ * Updates the state for a move of the player to move, followed by switching
+ * the boards, exactly like the search does with do_move and switch_boards.
+ *
+ * @param[in,out] The state
+ * @param[in] The coordinate of the new disc
+ * @param[in] The discs that were flipped by the move
+ */
+void update_eval_state(eval_state_t *state, uint8_t coordinate, uint64_t flipped);
+
+/**
+ * Updates the state for a pass, the equivalent of switch_boards
+ */
+void switch_eval_state(eval_state_t *state);
+
+/**
+ * The hand weighted evaluation: disc count, corners, mobility and a weight
+ * per square. Computed with a popcount per group of equally weighted squares
+ * and a single pass that generates the moves of both players.
+ *
+ * @param[in] The board, from the perspective of the player to move
+ */
+double classic_evaluation(board_t board);
+
+/**
+ * Same as classic_evaluation, but only mobility has to be computed at the leaf
+ */
+double classic_evaluation_state(board_t board, const eval_state_t *state);
+
+/**
+ * The square by square implementation of classic_evaluation. Gives identical
+ * results, but is several times slower. Only kept to verify the fast version
+ * against.
+ */
+double reference_evaluation(board_t board);
+
+#endif
@@ -0,0 +1,194 @@
+#include "nnue.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define OWN 0
+#define OTHER 64
+
+// Activations are in 1/127 units, int8 weights in 1/64 units
+#define ACTIVATION_MAX 127
+#define WEIGHT_SHIFT 6
+
+alignas(32) static int16_t feature_weights[NNUE_FEATURES][NNUE_HIDDEN];
+alignas(32) static int16_t feature_bias[NNUE_HIDDEN];
+alignas(32) static int8_t l1_weights[NNUE_L1][2 * NNUE_HIDDEN];
+static int32_t l1_bias[NNUE_L1];
+alignas(32) static int8_t output_weights[NNUE_L1];
+static int32_t output_bias;
+
+// The change of the accumulator of the mover when one of the discs of the
+// other colour flips to its own, own minus other. The accumulator of the other
+// player changes by the negation.
+alignas(32) static int16_t flip_weights[64][NNUE_HIDDEN];
+
+static bool loaded = false;
+
+bool load_nnue(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+
+	nnue_header_t header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1
+		&& strncmp(header.magic, NNUE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == NNUE_VERSION
+		&& header.features == NNUE_FEATURES
+		&& header.hidden == NNUE_HIDDEN
+		&& header.l1 == NNUE_L1;
+
+	// Read everything before replacing the network in use, so a broken file
+	// does not leave half a network behind
+	static int16_t new_feature_weights[NNUE_FEATURES][NNUE_HIDDEN];
+	static int16_t new_feature_bias[NNUE_HIDDEN];
+	static int8_t new_l1_weights[NNUE_L1][2 * NNUE_HIDDEN];
+	static int32_t new_l1_bias[NNUE_L1];
+	static int8_t new_output_weights[NNUE_L1];
+	int32_t new_output_bias;
+
+	valid = valid
+		&& fread(new_feature_weights, sizeof(new_feature_weights), 1, file) == 1
+		&& fread(new_feature_bias, sizeof(new_feature_bias), 1, file) == 1
+		&& fread(new_l1_weights, sizeof(new_l1_weights), 1, file) == 1
+		&& fread(new_l1_bias, sizeof(new_l1_bias), 1, file) == 1
+		&& fread(new_output_weights, sizeof(new_output_weights), 1, file) == 1
+		&& fread(&new_output_bias, sizeof(new_output_bias), 1, file) == 1
+		&& fgetc(file) == EOF;
+	fclose(file);
+
+	if (!valid) {
+		fprintf(stderr, "ERROR: %s is not a valid network file\n", path);
+		return false;
+	}
+
+	memcpy(feature_weights, new_feature_weights, sizeof(feature_weights));
+	memcpy(feature_bias, new_feature_bias, sizeof(feature_bias));
+	memcpy(l1_weights, new_l1_weights, sizeof(l1_weights));
+	memcpy(l1_bias, new_l1_bias, sizeof(l1_bias));
+	memcpy(output_weights, new_output_weights, sizeof(output_weights));
+	output_bias = new_output_bias;
+
+	for (uint8_t square = 0; square < 64; ++square)
+		for (uint8_t i = 0; i < NNUE_HIDDEN; ++i)
+			flip_weights[square][i] = feature_weights[OWN + square][i] - feature_weights[OTHER + square][i];
+
+	loaded = true;
+	return true;
+}
+
+bool nnue_loaded(void) {
+	return loaded;
+}
+
+static void add_row(int16_t *accumulator, const int16_t *row) {
+	for (uint8_t i = 0; i < NNUE_HIDDEN; ++i)
+		accumulator[i] += row[i];
+}
+
+static void sub_row(int16_t *accumulator, const int16_t *row) {
+	for (uint8_t i = 0; i < NNUE_HIDDEN; ++i)
+		accumulator[i] -= row[i];
+}
+
+void refresh_accumulators(board_t board, int16_t *player, int16_t *opponent) {
+	memcpy(player, feature_bias, sizeof(feature_bias));
+	memcpy(opponent, feature_bias, sizeof(feature_bias));
+
+	for (uint64_t b = board.player; b != 0; b &= b - 1) {
+		add_row(player, feature_weights[OWN + __builtin_ctzll(b)]);
+		add_row(opponent, feature_weights[OTHER + __builtin_ctzll(b)]);
+	}
+	for (uint64_t b = board.opponent; b != 0; b &= b - 1) {
+		add_row(player, feature_weights[OTHER + __builtin_ctzll(b)]);
+		add_row(opponent, feature_weights[OWN + __builtin_ctzll(b)]);
+	}
+}
+
+void update_accumulators(int16_t *mover, int16_t *other, uint8_t coordinate, uint64_t flipped) {
+	add_row(mover, feature_weights[OWN + coordinate]);
+	add_row(other, feature_weights[OTHER + coordinate]);
+
+	for (; flipped != 0; flipped &= flipped - 1) {
+		add_row(mover, flip_weights[__builtin_ctzll(flipped)]);
+		sub_row(other, flip_weights[__builtin_ctzll(flipped)]);
+	}
+}
+
+/**
+ * Clips the accumulators to [0, 127] and packs them into bytes, the
+ * accumulator of the player to move first
+ */
+static void clipped_activations(const int16_t *player, const int16_t *opponent, uint8_t *activations) {
+#ifdef __AVX2__
+	const __m256i zero = _mm256_setzero_si256();
+	for (uint8_t half = 0; half < 2; ++half) {
+		const int16_t *accumulator = half == 0 ? player : opponent;
+		for (uint8_t i = 0; i < NNUE_HIDDEN; i += 32) {
+			__m256i low = _mm256_loadu_si256((const __m256i *) (accumulator + i));
+			__m256i high = _mm256_loadu_si256((const __m256i *) (accumulator + i + 16));
+			// Saturating pack to int8 clips at 127, the max with zero clips
+			// the negative values. The pack interleaves 128 bit lanes, which
+			// the permute undoes.
+			__m256i packed = _mm256_max_epi8(_mm256_packs_epi16(low, high), zero);
+			packed = _mm256_permute4x64_epi64(packed, 0xD8);
+			_mm256_storeu_si256((__m256i *) (activations + half * NNUE_HIDDEN + i), packed);
+		}
+	}
+#else
+	for (uint8_t i = 0; i < NNUE_HIDDEN; ++i) {
+		activations[i] = player[i] < 0 ? 0 : (player[i] > ACTIVATION_MAX ? ACTIVATION_MAX : player[i]);
+		activations[NNUE_HIDDEN + i] = opponent[i] < 0 ? 0 : (opponent[i] > ACTIVATION_MAX ? ACTIVATION_MAX : opponent[i]);
+	}
+#endif
+}
+
+/**
+ * Dot product of unsigned activations and signed weights. With activations of
+ * at most 127 the pairwise sums of maddubs can not saturate, so both versions
+ * give the same result.
+ */
+static int32_t dot(const uint8_t *activations, const int8_t *weights, uint8_t n) {
+#ifdef __AVX2__
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i sum = _mm256_setzero_si256();
+	for (uint8_t i = 0; i < n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) (activations + i));
+		__m256i w = _mm256_loadu_si256((const __m256i *) (weights + i));
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, w), ones));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+	return _mm_cvtsi128_si32(s);
+#else
+	int32_t sum = 0;
+	for (uint8_t i = 0; i < n; ++i)
+		sum += activations[i] * weights[i];
+	return sum;
+#endif
+}
+
+double nnue_evaluation_accumulators(const int16_t *player, const int16_t *opponent) {
+	alignas(32) uint8_t activations[2 * NNUE_HIDDEN];
+	alignas(32) uint8_t hidden[NNUE_L1];
+
+	clipped_activations(player, opponent, activations);
+
+	for (uint8_t i = 0; i < NNUE_L1; ++i) {
+		int32_t value = (dot(activations, l1_weights[i], 2 * NNUE_HIDDEN) + l1_bias[i]) >> WEIGHT_SHIFT;
+		hidden[i] = value < 0 ? 0 : (value > ACTIVATION_MAX ? ACTIVATION_MAX : value);
+	}
+
+	int32_t output = dot(hidden, output_weights, NNUE_L1) + output_bias;
+	return output * (8192.0 / (ACTIVATION_MAX << WEIGHT_SHIFT));
+}
+
+double nnue_evaluation(board_t board) {
+	alignas(32) int16_t player[NNUE_HIDDEN];
+	alignas(32) int16_t opponent[NNUE_HIDDEN];
+	refresh_accumulators(board, player, opponent);
+	return nnue_evaluation_accumulators(player, opponent);
+}
@@ -0,0 +1,93 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "../lib/state_t.hpp"
+
+/**
+ * A small efficiently updatable neural network. The input is one feature per
+ * square and colour, relative to a perspective: a disc of the perspective's
+ * own colour on a square, or a disc of the other colour. The first layer is an
+ * accumulator per perspective, the feature bias plus the sum of the weights of
+ * all active features. It only changes by a few rows per move, so the search
+ * keeps it up to date instead of recomputing it.
+ *
+ * The accumulators of the player to move and of the opponent are clipped to
+ * [0, 127] and concatenated, followed by a hidden layer of NNUE_L1 neurons
+ * with int8 weights, and a single output.
+ *
+ * Quantization: the accumulator is in 1/127 units, so a clipped activation of
+ * 127 is 1.0. The int8 weights of the hidden and output layers are in 1/64
+ * units. The output is in 1/(127 * 64) discs.
+ */
+
+#define NNUE_FEATURES 128
+#define NNUE_HIDDEN 64
+#define NNUE_L1 32
+
+/**
+ * The network file starts with this header, followed by the little endian
+ * parameters in this order:
+ *   int16_t feature_weights[NNUE_FEATURES][NNUE_HIDDEN]
+ *   int16_t feature_bias[NNUE_HIDDEN]
+ *   int8_t l1_weights[NNUE_L1][2 * NNUE_HIDDEN]
+ *   int32_t l1_bias[NNUE_L1]
+ *   int8_t output_weights[NNUE_L1]
+ *   int32_t output_bias
+ * Features 0 through 63 are the squares of the perspective's own discs,
+ * 64 through 127 those of the other colour.
+ */
+#define NNUE_MAGIC "OOOONNU"
+#define NNUE_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t features;
+	uint32_t hidden;
+	uint32_t l1;
+} nnue_header_t;
+
+/**
+ * Loads a network. Replaces the network that was loaded before.
+ *
+ * @param[in] Path to the network file
+ * @return Whether the file was valid and is now in use
+ */
+bool load_nnue(const char *path);
+bool nnue_loaded(void);
+
+/**
+ * Computes the accumulators of a board from scratch
+ *
+ * @param[in] The board, from the perspective of the player to move
+ * @param[out] Accumulator from the perspective of the player to move
+ * @param[out] Accumulator from the perspective of the opponent
+ */
+void refresh_accumulators(board_t board, int16_t *player, int16_t *opponent);
+
+/**
+ * Updates the accumulators for a move
+ *
+ * @param[in,out] Accumulator from the perspective of the player that moved
+ * @param[in,out] Accumulator from the perspective of the other player
+ * @param[in] The coordinate of the new disc
+ * @param[in] The discs that were flipped by the move
+ */
+void update_accumulators(int16_t *mover, int16_t *other, uint8_t coordinate, uint64_t flipped);
+
+/**
+ * Runs the rest of the network on up to date accumulators. Returns the
+ * evaluation in the same unit as the final score of a game, the disc
+ * difference times 8192.
+ */
+double nnue_evaluation_accumulators(const int16_t *player, const int16_t *opponent);
+
+/**
+ * Evaluates the board from scratch, from the perspective of the player to move
+ */
+double nnue_evaluation(board_t board);
+
+#endif
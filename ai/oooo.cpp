@@ -1,12 +1,93 @@
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "ai.hpp"
+#include "book.hpp"
+#include "nnue.hpp"
+#include "patterns.hpp"
+#include "protocol.hpp"
+#include "solved.hpp"
+#include "../lib/eval_cache.hpp"
 #include "../lib/state_t.hpp"
 
+#define DEFAULT_PATTERN_FILE "patterns.bin"
+#define DEFAULT_BOOK_FILE "book.bin"
+
 static board_t board;
 static bool start_player = true;
+static bool own_book = true;
+
+// While pondering, the search runs in the background on the board after the
+// reply we expect from the opponent
+static bool ponder = false;
+static bool pondering = false;
+static bool ponder_hit = false;
+static int8_t ponder_reply;
+
+// The table keeps boards from the perspective of the player to move at the
+// root of its search, so it is only of use to a search for the same player
+static bool table_player = true;
+
+// The search runs on a thread of its own, so stop, isready and quit are still
+// read while it runs. The go thread waits for the search to report its move.
+// Other commands wait for the go thread, so only one thread touches the board.
+static std::thread go_thread;
+static std::mutex output_lock;
+
+static void wait_go(void) {
+	if (go_thread.joinable())
+		go_thread.join();
+}
+
+static void print_info(const search_info_t *info) {
+	std::string line = info_line(info);
+
+	std::lock_guard<std::mutex> lock(output_lock);
+	std::cout << line << std::endl;
+}
+
+/**
+ * Stops pondering, if we were
+ */
+static void stop_pondering(bool keep_table) {
+	if (!pondering)
+		return;
+
+	stop_search();
+	wait_search();
+	pondering = false;
+	ponder_hit = false;
+	end_search(keep_table);
+}
+
+/**
+ * Starts searching the board after the expected reply of the opponent, who is
+ * to move on the board
+ */
+static void start_pondering(void) {
+	ponder_reply = ponder_move(board);
+	if (ponder_reply == -1) {
+		end_search(false);
+		return;
+	}
+
+	board_t ponder_board = board;
+	do_move(&ponder_board, ponder_reply);
+	switch_boards(&ponder_board);
+	if (!has_valid_move(ponder_board)) {
+		end_search(false);
+		return;
+	}
+
+	search_limits_t limits = {.move_time_ms = 0, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = true};
+	end_search(true);
+	start_search(ponder_board, &limits);
+	pondering = true;
+	table_player = !start_player;
+}
 
 static void debug(void) {
 	if (start_player) {
@@ -18,34 +99,65 @@ static void debug(void) {
 	}
 }
 
-static void go(void) {
-	uint64_t time_ms = 10000;
+/**
+ * Waits for the search of go, reports its move and plays it
+ *
+ * @param book_choice - the move from the book, or -1 to wait for the search
+ */
+static void finish_go(int8_t book_choice) {
+	int8_t choice = book_choice != -1 ? book_choice : wait_search();
+	pondering = false;
+	ponder_hit = false;
 
-	std::string arg;
-	std::string line;
-	std::getline(std::cin, line);
-	std::istringstream iss(line);
-	while (iss >> arg) {
-		if (arg == "time")
-			iss >> time_ms;
-		else
-			std::cerr << "Unrecognized sub-command: " << arg << std::endl;
+	{
+		std::lock_guard<std::mutex> lock(output_lock);
+		std::cout << "bestmove " << move_name(choice) << std::endl;
 	}
 
-	int8_t choice = ai_turn(board, time_ms);
-	char c, r;
-	from_coordinate(choice, &c, &r);
-	std::cout << "bestmove " << c << r << std::endl;
-
 	do_move(&board, choice);
 	switch_boards(&board);
 	start_player = !start_player;
 	if (!has_valid_move(board)) {
 		switch_boards(&board);
 		start_player = !start_player;
+		end_search(false);
+	} else if (ponder) {
+		start_pondering();
+	} else {
+		end_search(false);
 	}
 }
 
+static void go(void) {
+	search_limits_t limits;
+	std::string line;
+	std::getline(std::cin, line);
+	std::istringstream iss(line);
+
+	// Black is to move whenever the player that started is to move
+	parse_go(iss, start_player, &limits);
+
+	// Known positions are not searched at all
+	int8_t book_choice = own_book ? book_move(board) : -1;
+
+	// The search of this position has been running since the opponent moved
+	if (book_choice != -1) {
+		stop_pondering(true);
+	} else if (pondering && ponder_hit) {
+		ponderhit(&limits);
+	} else {
+		// After a pass the same player moved twice, and the boards in the
+		// table are those of the other player
+		stop_pondering(true);
+		if (table_player != start_player)
+			end_search(false);
+		start_search(board, &limits);
+		table_player = start_player;
+	}
+
+	go_thread = std::thread(finish_go, book_choice);
+}
+
 static void play(void) {
 	char column, row;
 
@@ -56,9 +168,23 @@ static void play(void) {
 
 	uint8_t coordinate = choice_column + choice_row * 8;
 
+	// On a miss the search is useless, but the table it filled is not
+	if (pondering) {
+		if (!ponder_hit && coordinate == ponder_reply)
+			ponder_hit = true;
+		else
+			stop_pondering(true);
+	}
+
 	do_move(&board, coordinate);
 	switch_boards(&board);
 	start_player = !start_player;
+
+	// Without a move we pass, and the opponent is to move again
+	if (!has_valid_move(board)) {
+		switch_boards(&board);
+		start_player = !start_player;
+	}
 }
 
 static void set_pos(void) {
@@ -66,6 +192,9 @@ static void set_pos(void) {
 
 	std::cin >> command;
 
+	stop_pondering(false);
+	end_search(false);
+
 	if (command == "startpos") {
 		board.player = 0b0000000000000000000000000000100000010000000000000000000000000000;
 		board.opponent = 0b0000000000000000000000000001000000001000000000000000000000000000;
@@ -73,7 +202,9 @@ static void set_pos(void) {
 		std::cin >> board.player >> board.opponent;
 	} else {
 		std::cerr << "Unrecognized sub-command: " << command << std::endl;
+		return;
 	}
+	start_player = true;
 }
 
 static void set_var(void) {
@@ -99,17 +230,113 @@ static void set_var(void) {
 		}
 	} while (!got_name || !got_value);
 
+	// Options may change what the table holds
+	stop_pondering(false);
+	end_search(false);
+
 	if (name == "MaxDepth") {
 		set_max_depth((uint8_t) std::stoi(value));
+	} else if (name == "MultiPV") {
+		set_multi_pv((uint8_t) std::stoi(value));
+	} else if (name == "Evaluator") {
+		bool available = false;
+		if (value == "classic")
+			available = set_evaluator(CLASSIC);
+		else if (value == "pattern")
+			available = set_evaluator(PATTERN);
+		else if (value == "nnue")
+			available = set_evaluator(NNUE);
+		if (!available)
+			std::cerr << "Evaluator not available: " << value << std::endl;
+	} else if (name == "PatternFile") {
+		// New weights have the same key in the evaluation cache as the old ones
+		if (load_patterns(value.c_str())) {
+			clear_eval_cache();
+			set_evaluator(PATTERN);
+		} else {
+			std::cerr << "Could not load pattern weights: " << value << std::endl;
+		}
+	} else if (name == "NNUEFile") {
+		if (load_nnue(value.c_str())) {
+			clear_eval_cache();
+			set_evaluator(NNUE);
+		} else {
+			std::cerr << "Could not load network: " << value << std::endl;
+		}
+	} else if (name == "BookFile") {
+		if (!load_book(value.c_str()))
+			std::cerr << "Could not load opening book: " << value << std::endl;
+	} else if (name == "SolvedFile") {
+		if (!open_solved(value.c_str()))
+			std::cerr << "Could not open solved position log: " << value << std::endl;
+	} else if (name == "SolvedMinDepth") {
+		set_solved_min_depth((uint8_t) std::stoi(value));
+	} else if (name == "OwnBook") {
+		own_book = value == "true";
+	} else if (name == "Ponder") {
+		ponder = value == "true";
+	} else if (name == "Hash") {
+		set_hash((size_t) std::stoul(value));
+	} else if (name == "EvalCache") {
+		resize_eval_cache((size_t) std::stoul(value));
+	} else if (name == "EvalCacheShared") {
+		set_eval_cache_shared(value == "true");
+	} else if (name == "LMRMinDepth") {
+		set_lmr_min_depth((uint8_t) std::stoi(value));
+	} else if (name == "LMRMinMove") {
+		set_lmr_min_move((uint8_t) std::stoi(value));
+	} else if (name == "LMREndgame") {
+		set_lmr_endgame((uint8_t) std::stoi(value));
+	} else if (name == "LMRBase") {
+		set_lmr_base(std::stod(value));
+	} else if (name == "LMRDivisor") {
+		set_lmr_divisor(std::stod(value));
+	} else if (name == "TraceFile") {
+		if (!set_trace_file(value.c_str()))
+			std::cerr << "Could not open trace file (or not built with TRACE): " << value << std::endl;
+	} else {
+		std::cerr << "Unrecognized option: " << name << std::endl;
 	}
 }
 
+static void stop(void) {
+	// A go that still searches reports its move first. Only then is it known
+	// whether it went on to ponder, and a ponder search that was stopped
+	// would otherwise be taken for a ponderhit by the next go.
+	if (go_thread.joinable()) {
+		stop_search();
+		wait_go();
+	}
+	stop_pondering(true);
+}
+
+static void is_ready(void) {
+	std::lock_guard<std::mutex> lock(output_lock);
+	std::cout << "readyok" << std::endl;
+}
+
 int main(void) {
 	bool finished = false;
 	std::string command;
 
+	// Mapping the weights is close to free, so the pattern evaluation is used
+	// whenever the default weight file is present
+	if (load_patterns(DEFAULT_PATTERN_FILE))
+		set_evaluator(PATTERN);
+	load_book(DEFAULT_BOOK_FILE);
+
+	set_info_callback(print_info);
+
 	while (!finished) {
-		std::cin >> command;
+		// At the end of the input, the last search is still finished and reported
+		if (!(std::cin >> command)) {
+			wait_go();
+			break;
+		}
+
+		// Everything but these commands waits for the search to finish
+		if (command != "stop" && command != "isready" && command != "quit")
+			wait_go();
 
 		if (command == "debug")
 			debug();
@@ -121,11 +348,19 @@ int main(void) {
 			set_pos();
 		else if (command == "setoption")
 			set_var();
+		else if (command == "stop")
+			stop();
+		else if (command == "isready")
+			is_ready();
 		else if (command == "quit")
 			finished = true;
 		else
 			std::cerr << "Unrecognized command: " << command << std::endl;
 	}
 
+	stop_search();
+	wait_go();
+	stop_pondering(false);
+
 	return 0;
 }
@@ -0,0 +1,252 @@
+#include "patterns.hpp"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#include "../lib/mapped_file.hpp"
+
+#define MAX_INSTANCES (PATTERN_TYPES * SYMMETRIES)
+
+static const char *pattern_squares[PATTERN_TYPES] = {
+	"a1 b1 c1 d1 e1 f1 g1 h1 b2 g2", // Edge + 2X
+	"a1 b1 c1 a2 b2 c2 a3 b3 c3",    // Corner 3x3
+	"a1 b1 c1 d1 e1 a2 b2 c2 d2 e2", // Corner 2x5
+	"a2 b2 c2 d2 e2 f2 g2 h2",       // Line 2
+	"a3 b3 c3 d3 e3 f3 g3 h3",       // Line 3
+	"a4 b4 c4 d4 e4 f4 g4 h4",       // Line 4
+	"a1 b2 c3 d4 e5 f6 g7 h8",       // Diagonal 8
+	"b1 c2 d3 e4 f5 g6 h7",          // Diagonal 7
+	"c1 d2 e3 f4 g5 h6",             // Diagonal 6
+	"d1 e2 f3 g4 h5",                // Diagonal 5
+	"e1 f2 g3 h4"                    // Diagonal 4
+};
+
+static pattern_instance_t instances[MAX_INSTANCES];
+static uint8_t nr_instances = 0;
+static uint32_t entries = 0;
+
+// The instances every square is part of, and the value of a single disc of
+// the player to move on that square in the configuration of the instance
+#define MAX_INSTANCES_PER_SQUARE 8
+typedef struct {
+	uint8_t count;
+	uint8_t instance[MAX_INSTANCES_PER_SQUARE];
+	uint16_t power[MAX_INSTANCES_PER_SQUARE];
+} square_instances_t;
+
+static square_instances_t squares[64];
+
+// Converts the bits of an extracted pattern to a base 3 number with ones
+static uint16_t ternary[1 << PATTERN_MAX_SIZE];
+
+static mapped_file_t weight_file = {NULL, 0};
+static const int16_t *weights = NULL;
+static uint32_t phases = 0;
+
+static uint64_t extract(uint64_t number, uint64_t mask) {
+#ifdef __BMI2__
+	return _pext_u64(number, mask);
+#else
+	uint64_t result = 0;
+	for (uint64_t bit = 1; mask != 0; bit <<= 1) {
+		if (number & mask & -mask)
+			result |= bit;
+		mask &= mask - 1;
+	}
+	return result;
+#endif
+}
+
+void init_patterns(void) {
+	if (nr_instances > 0)
+		return;
+
+	for (uint32_t i = 0; i < (1 << PATTERN_MAX_SIZE); ++i) {
+		ternary[i] = 0;
+		for (uint32_t bit = PATTERN_MAX_SIZE, power = 19683; bit-- > 0; power /= 3)
+			if (i & (1 << bit))
+				ternary[i] += power;
+	}
+
+	uint64_t seen[MAX_INSTANCES];
+	for (uint8_t type = 0; type < PATTERN_TYPES; ++type) {
+		uint64_t mask = 0;
+		uint8_t size = 0;
+		for (const char *c = pattern_squares[type]; *c != '\0'; c += c[2] == '\0' ? 2 : 3) {
+			set(&mask, to_coordinate(c[0], c[1]));
+			size++;
+		}
+
+		// Every symmetry of the board moves the pattern to another place,
+		// but symmetric patterns end up on the same squares more than once
+		for (uint8_t symmetry = 0; symmetry < SYMMETRIES; ++symmetry) {
+			uint64_t covered = 0;
+			for (uint8_t i = 0; i < 64; ++i)
+				if (is_set(mask, transform_square(i, symmetry)))
+					set(&covered, i);
+
+			bool duplicate = false;
+			for (uint8_t i = 0; i < nr_instances; ++i)
+				duplicate |= instances[i].type == type && seen[i] == covered;
+			if (duplicate)
+				continue;
+
+			seen[nr_instances] = covered;
+			instances[nr_instances++] = {
+				.mask = mask,
+				.offset = entries,
+				.symmetry = symmetry,
+				.type = type,
+				.size = size
+			};
+		}
+
+		uint32_t configurations = 1;
+		for (uint8_t i = 0; i < size; ++i)
+			configurations *= 3;
+		entries += configurations;
+	}
+
+	assert(nr_instances == PATTERN_INSTANCES);
+
+	// The digit of a square is its rank among the squares of the base
+	// pattern, after moving it there with the symmetry of the instance
+	for (uint8_t i = 0; i < nr_instances; ++i) {
+		for (uint8_t coordinate = 0; coordinate < 64; ++coordinate) {
+			uint64_t square = (uint64_t) 1 << transform_square(coordinate, instances[i].symmetry);
+			if ((instances[i].mask & square) == 0)
+				continue;
+
+			uint16_t power = 1;
+			for (uint8_t rank = count(instances[i].mask & (square - 1)); rank > 0; --rank)
+				power *= 3;
+
+			square_instances_t *s = &squares[coordinate];
+			s->instance[s->count] = i;
+			s->power[s->count] = power;
+			s->count++;
+		}
+	}
+}
+
+uint32_t pattern_entries(void) {
+	init_patterns();
+	return entries;
+}
+
+const pattern_instance_t *pattern_instances(uint8_t *count) {
+	init_patterns();
+	*count = nr_instances;
+	return instances;
+}
+
+void pattern_indices(board_t board, uint16_t *indices) {
+	board_t symmetric[SYMMETRIES];
+	for (uint8_t symmetry = 0; symmetry < SYMMETRIES; ++symmetry)
+		symmetric[symmetry] = transform_board(board, symmetry);
+
+	for (uint8_t i = 0; i < nr_instances; ++i) {
+		const pattern_instance_t *instance = &instances[i];
+		const board_t *b = &symmetric[instance->symmetry];
+		indices[i] = ternary[extract(b->player, instance->mask)]
+			+ 2 * ternary[extract(b->opponent, instance->mask)];
+	}
+}
+
+void update_pattern_indices(uint16_t *mover, uint16_t *other, uint8_t coordinate, uint64_t flipped) {
+	// An empty square becomes a 1 for the mover and a 2 for the other player
+	const square_instances_t *s = &squares[coordinate];
+	for (uint8_t i = 0; i < s->count; ++i) {
+		mover[s->instance[i]] += s->power[i];
+		other[s->instance[i]] += 2 * s->power[i];
+	}
+
+	// A flipped disc goes from 2 to 1 for the mover, and the other way around
+	for (; flipped != 0; flipped &= flipped - 1) {
+		s = &squares[__builtin_ctzll(flipped)];
+		for (uint8_t i = 0; i < s->count; ++i) {
+			mover[s->instance[i]] -= s->power[i];
+			other[s->instance[i]] += s->power[i];
+		}
+	}
+}
+
+static uint8_t phase_of(uint8_t empties, uint32_t nr_phases) {
+	// Positions that can not be reached in a game still get a phase
+	if (empties > 60)
+		empties = 60;
+	return empties * nr_phases / 61;
+}
+
+uint8_t pattern_phase(board_t board, uint32_t nr_phases) {
+	return phase_of(count(~(board.player | board.opponent)), nr_phases);
+}
+
+bool load_patterns(const char *path) {
+	init_patterns();
+
+	mapped_file_t file;
+	if (!map_file(path, &file))
+		return false;
+
+	const pattern_header_t *header = (const pattern_header_t *) file.data;
+	if (file.size < sizeof(*header)
+			|| strncmp(header->magic, PATTERN_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != PATTERN_VERSION
+			|| header->entries != entries
+			|| header->phases == 0
+			|| file.size != sizeof(*header) + (size_t) header->phases * header->entries * sizeof(int16_t)) {
+		fprintf(stderr, "ERROR: %s is not a valid pattern weight file\n", path);
+		unmap_file(&file);
+		return false;
+	}
+
+	unload_patterns();
+	weight_file = file;
+	phases = header->phases;
+	weights = (const int16_t *) (header + 1);
+	return true;
+}
+
+void unload_patterns(void) {
+	unmap_file(&weight_file);
+	weights = NULL;
+	phases = 0;
+}
+
+bool patterns_loaded(void) {
+	return weights != NULL;
+}
+
+double pattern_evaluation(board_t board) {
+	const int16_t *w = weights + (size_t) pattern_phase(board, phases) * entries;
+
+	board_t symmetric[SYMMETRIES];
+	for (uint8_t symmetry = 0; symmetry < SYMMETRIES; ++symmetry)
+		symmetric[symmetry] = transform_board(board, symmetry);
+
+	int32_t score = 0;
+	for (uint8_t i = 0; i < nr_instances; ++i) {
+		const pattern_instance_t *instance = &instances[i];
+		const board_t *b = &symmetric[instance->symmetry];
+		score += w[instance->offset
+			+ ternary[extract(b->player, instance->mask)]
+			+ 2 * ternary[extract(b->opponent, instance->mask)]];
+	}
+
+	return score * (8192.0 / PATTERN_SCALE);
+}
+
+double pattern_evaluation_indices(const uint16_t *indices, uint8_t empties) {
+	const int16_t *w = weights + (size_t) phase_of(empties, phases) * entries;
+
+	int32_t score = 0;
+	for (uint8_t i = 0; i < PATTERN_INSTANCES; ++i)
+		score += w[instances[i].offset + indices[i]];
+
+	return score * (8192.0 / PATTERN_SCALE);
+}
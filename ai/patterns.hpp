@@ -0,0 +1,129 @@
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "../lib/state_t.hpp"
+
+/**
+ * Pattern based evaluation. The board is covered with overlapping patterns
+ * (the edges with the X squares, 3x3 and 2x5 corners, the lines parallel to
+ * the edges and the diagonals). Every configuration of a pattern is a base 3
+ * number, where an empty square is 0, a disc of the player to move is 1 and
+ * a disc of the opponent is 2. Each configuration has a learned weight per
+ * game phase, and the evaluation is the sum of the weights of all pattern
+ * instances on the board.
+ *
+ * All symmetric instances of a pattern share the same weights. The index of
+ * an instance is found by transforming the board with the symmetry of that
+ * instance and extracting the squares of the base pattern from it. Patterns
+ * that are symmetric themselves (the edge or a diagonal) can be read in either
+ * direction, so the weights of a configuration and its mirror image should be
+ * equal.
+ */
+
+#define PATTERN_TYPES 11
+#define PATTERN_INSTANCES 46
+#define PATTERN_MAX_SIZE 10
+
+/**
+ * Weights are stored in 1/PATTERN_SCALE discs. The evaluation is returned in
+ * the same unit as the final score of a game, which is the disc difference
+ * times 8192.
+ */
+#define PATTERN_SCALE 128
+
+/**
+ * The weight file starts with this header, followed by phases * entries
+ * little endian int16_t weights. Phase p holds the weights for positions with
+ * empty squares e where p = e * phases / 61.
+ */
+#define PATTERN_MAGIC "OOOOPAT"
+#define PATTERN_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t phases;
+	uint32_t entries;
+	uint32_t reserved;
+} pattern_header_t;
+
+typedef struct {
+	uint64_t mask;
+	uint32_t offset;
+	uint8_t symmetry;
+	uint8_t type;
+	uint8_t size;
+} pattern_instance_t;
+
+/**
+ * Initializes the pattern definitions. Safe to call more than once.
+ */
+void init_patterns(void);
+
+/**
+ * Number of weights in a single phase, the sum of 3^size over all types
+ */
+uint32_t pattern_entries(void);
+
+/**
+ * All pattern instances that are evaluated for a board
+ *
+ * @param[out] Number of instances
+ */
+const pattern_instance_t *pattern_instances(uint8_t *nr_instances);
+
+/**
+ * Computes the configuration of every pattern instance, in the order of
+ * pattern_instances. The weight of an instance is at its offset plus its
+ * configuration.
+ *
+ * @param[in] The board, from the perspective of the player to move
+ * @param[out] PATTERN_INSTANCES configurations
+ */
+void pattern_indices(board_t board, uint16_t *indices);
+
+/**
+ * Incrementally updates the configurations of the pattern instances for a
+ * move. Configurations are kept from the perspective of both players, since
+ * the digits of the player and the opponent swap every turn.
+ *
+ * @param[in,out] Configurations from the perspective of the player that moved
+ * @param[in,out] Configurations from the perspective of the other player
+ * @param[in] The coordinate of the new disc
+ * @param[in] The discs that were flipped by the move
+ */
+void update_pattern_indices(uint16_t *mover, uint16_t *other, uint8_t coordinate, uint64_t flipped);
+
+/**
+ * The phase used for a board when the weights have the given number of phases
+ */
+uint8_t pattern_phase(board_t board, uint32_t phases);
+
+/**
+ * Memory maps a weight file. Replaces any weights loaded before.
+ *
+ * @param[in] Path to the weight file
+ * @return Whether the file was valid and is now in use
+ */
+bool load_patterns(const char *path);
+void unload_patterns(void);
+bool patterns_loaded(void);
+
+/**
+ * Evaluates the board with the loaded weights, from the perspective of the
+ * player to move. Only valid when patterns_loaded() is true.
+ */
+double pattern_evaluation(board_t board);
+
+/**
+ * Same as pattern_evaluation, but from configurations that are already known
+ *
+ * @param[in] The configurations from the perspective of the player to move
+ * @param[in] The number of empty squares on the board
+ */
+double pattern_evaluation_indices(const uint16_t *indices, uint8_t empties);
+
+#endif
@@ -0,0 +1,83 @@
+#include "protocol.hpp"
+
+#include <iomanip>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+
+#include "../lib/state_t.hpp"
+
+std::string info_line(const search_info_t *info) {
+	std::ostringstream line;
+	line << "info";
+	if (info->multi_pv > 0)
+		line << " multipv " << (unsigned) info->multi_pv;
+	line << " depth " << (unsigned) info->depth;
+	line << " score " << (long) lround(info->score);
+	if (info->upper_bound)
+		line << " upperbound";
+	line << " nodes " << info->nodes;
+	line << " nps " << (info->time_ms > 0 ? info->nodes * 1000 / info->time_ms : info->nodes * 1000);
+	line << " time " << info->time_ms;
+	if (info->ebf > 0)
+		line << " ebf " << std::fixed << std::setprecision(2) << info->ebf;
+	line << " pv";
+	for (uint8_t i = 0; i < info->pv_length; ++i)
+		line << " " << move_name(info->pv[i]);
+	return line.str();
+}
+
+std::string move_name(uint8_t move) {
+	char c, r;
+	from_coordinate(move, &c, &r);
+	return std::string(1, c) + r;
+}
+
+void parse_go(std::istream &args, bool black, search_limits_t *limits) {
+	bool clock = false;
+	uint64_t time_ms = 10000;
+	uint64_t black_ms = 0, white_ms = 0, black_inc_ms = 0, white_inc_ms = 0;
+	unsigned moves_to_go = 0;
+	bool timed = false;
+	uint64_t nodes = 0;
+	unsigned depth = 0;
+
+	*limits = {.move_time_ms = 0, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+
+	std::string arg;
+	while (args >> arg) {
+		if (arg == "time") {
+			args >> time_ms;
+			timed = true;
+		} else if (arg == "depth") {
+			args >> depth;
+		} else if (arg == "nodes") {
+			args >> nodes;
+		} else if (arg == "btime") {
+			args >> black_ms;
+			clock = true;
+		} else if (arg == "wtime") {
+			args >> white_ms;
+			clock = true;
+		} else if (arg == "binc") {
+			args >> black_inc_ms;
+		} else if (arg == "winc") {
+			args >> white_inc_ms;
+		} else if (arg == "movestogo") {
+			args >> moves_to_go;
+		} else {
+			std::cerr << "Unrecognized sub-command: " << arg << std::endl;
+		}
+	}
+
+	limits->max_nodes = nodes;
+	limits->max_depth = depth > 64 ? 64 : depth;
+
+	if (clock) {
+		limits->remaining_ms = black ? black_ms : white_ms;
+		limits->increment_ms = black ? black_inc_ms : white_inc_ms;
+		limits->moves_to_go = moves_to_go > 255 ? 255 : moves_to_go;
+	} else if (timed || (nodes == 0 && depth == 0)) {
+		limits->move_time_ms = time_ms;
+	}
+}
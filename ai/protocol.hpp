@@ -0,0 +1,35 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <istream>
+#include <stdbool.h>
+#include <string>
+
+#include "ai.hpp"
+
+/**
+ * The parts of the text protocol that the engine and the server share
+ */
+
+/**
+ * The info line of a completed iteration, without the end of the line
+ */
+std::string info_line(const search_info_t *info);
+
+/**
+ * A move as a human readable coordinate, such as c4
+ */
+std::string move_name(uint8_t move);
+
+/**
+ * Reads the arguments of go until the end of the stream. Without a clock, a
+ * fixed time per move is used, 10 seconds unless it is given. With a depth or
+ * node limit only, there is no time limit.
+ *
+ * @param[in] The arguments
+ * @param[in] Whether black is to move, whose clock is used
+ * @param[out] The limits of the search
+ */
+void parse_go(std::istream &args, bool black, search_limits_t *limits);
+
+#endif
@@ -0,0 +1,435 @@
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "ai.hpp"
+#include "book.hpp"
+#include "nnue.hpp"
+#include "patterns.hpp"
+#include "protocol.hpp"
+#include "solved.hpp"
+#include "../lib/eval_hashmap.hpp"
+#include "../lib/state_t.hpp"
+
+/**
+ * Plays many games at once over one stdin and stdout. Every line starts with
+ * the name of a game session, followed by a command of the engine (see
+ * oooo.cpp):
+ *
+ *     <session> position startpos | bitboard <player> <opponent>
+ *     <session> play <move>
+ *     <session> go [time <ms> | btime <ms> wtime <ms> [binc <ms>] [winc <ms>] [movestogo <n>]]
+ *                  [depth <n>] [nodes <n>]
+ *     <session> stop
+ *     <session> setoption name <name> value <value>
+ *     <session> close
+ *
+ * A session is opened by its first command, and every reply for it starts
+ * with its name. isready and quit on a line of their own are for the server.
+ * Commands that arrive while a session is searching wait for its bestmove,
+ * except for stop.
+ *
+ * The searches of all sessions run on a fixed number of worker threads and
+ * share one transposition table of --hash MB. The clock of a session starts
+ * when its go arrives, so the time it waits for a free worker is taken off
+ * its search.
+ */
+
+#define DEFAULT_PATTERN_FILE "patterns.bin"
+#define DEFAULT_BOOK_FILE "book.bin"
+
+// The size of the shared table, of both halves together
+#define SERVER_HASH_MB 512
+
+typedef struct session {
+	std::string name;
+	Search search;
+	board_t board;
+	bool black;                      // Whether black is to move
+	bool own_book;
+	bool busy;                       // Its go waits for a worker or is searching
+	bool stopped;                    // Its go was stopped
+	bool closed;
+	std::deque<std::string> backlog; // Commands that have not run yet
+} session_t;
+
+typedef struct {
+	session_t *session;
+	search_limits_t limits;
+	long received_ms;
+} request_t;
+
+// Everything but the output is guarded by lock
+static std::mutex lock;
+static std::mutex output_lock;
+static std::condition_variable work;
+
+static std::map<std::string, std::unique_ptr<session_t>> sessions;
+static std::deque<request_t> requests;
+static bool quitting = false;
+static bool use_patterns = false;
+
+// The table stores values from the perspective of the player at the root of
+// the search that stored them, which depends on the parity of the number of
+// empty squares at the root. Searches of either parity get a half of their own.
+// Sessions may use different evaluators, whose boards are kept apart by their
+// tag (see find_board). Sessions with different reductions do use each other's
+// values: those are of the same evaluation, only searched more or less deeply.
+static eval_map_t tables[2];
+static size_t hash_mb = SERVER_HASH_MB;
+
+static long get_time_ms(void) {
+	struct timespec spec;
+
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+}
+
+static void send(const std::string &name, const std::string &line) {
+	std::lock_guard<std::mutex> guard(output_lock);
+	std::cout << name << " " << line << std::endl;
+}
+
+static session_t *open_session(const std::string &name) {
+	std::unique_ptr<session_t> &session = sessions[name];
+	if (session != NULL)
+		return session.get();
+
+	session.reset(new session_t());
+	session->name = name;
+	session->board.player = 0x0000000810000000ULL;
+	session->board.opponent = 0x0000001008000000ULL;
+	session->black = true;
+	session->own_book = true;
+	if (use_patterns)
+		session->search.set_evaluator(PATTERN);
+
+	std::string session_name = name;
+	session->search.set_info_callback([session_name](const search_info_t *info) {
+		send(session_name, info_line(info));
+	});
+	return session.get();
+}
+
+/**
+ * Reports the move and plays it. A player without a move passes.
+ */
+static void finish_go(session_t *session, int8_t move) {
+	send(session->name, "bestmove " + move_name(move));
+
+	do_move(&session->board, move);
+	switch_boards(&session->board);
+	session->black = !session->black;
+	if (!has_valid_move(session->board)) {
+		switch_boards(&session->board);
+		session->black = !session->black;
+	}
+}
+
+static void go(session_t *session, std::istream &args) {
+	search_limits_t limits;
+	parse_go(args, session->black, &limits);
+
+	if (!has_valid_move(session->board)) {
+		std::cerr << "No legal move in session " << session->name << std::endl;
+		return;
+	}
+
+	// Known positions are not searched at all
+	int8_t book_choice = session->own_book ? book_move(session->board) : -1;
+	if (book_choice != -1) {
+		finish_go(session, book_choice);
+		return;
+	}
+
+	session->busy = true;
+	session->stopped = false;
+	requests.push_back({session, limits, get_time_ms()});
+	work.notify_one();
+}
+
+static void play(session_t *session, std::istream &args) {
+	std::string move;
+	args >> move;
+
+	uint8_t coordinate = 64;
+	if (move.size() == 2 && move[0] >= 'a' && move[0] <= 'h' && move[1] >= '1' && move[1] <= '8')
+		coordinate = to_coordinate(move[0], move[1]);
+	if (coordinate == 64 || !is_set(get_valid_moves(session->board), coordinate)) {
+		std::cerr << "Illegal move in session " << session->name << ": " << move << std::endl;
+		return;
+	}
+
+	do_move(&session->board, coordinate);
+	switch_boards(&session->board);
+	session->black = !session->black;
+
+	// Without a move the session passes, and the opponent is to move again
+	if (!has_valid_move(session->board)) {
+		switch_boards(&session->board);
+		session->black = !session->black;
+	}
+}
+
+static void set_position(session_t *session, std::istream &args) {
+	std::string command;
+	args >> command;
+
+	if (command == "startpos") {
+		session->board.player = 0x0000000810000000ULL;
+		session->board.opponent = 0x0000001008000000ULL;
+	} else if (command == "bitboard") {
+		args >> session->board.player >> session->board.opponent;
+	} else {
+		std::cerr << "Unrecognized sub-command: " << command << std::endl;
+		return;
+	}
+	session->black = true;
+}
+
+/**
+ * Options of a single session. Files are loaded for all sessions at once, on
+ * the command line.
+ */
+static void set_option(session_t *session, std::istream &args) {
+	std::string command, name, value;
+	while (args >> command) {
+		if (command == "name")
+			args >> name;
+		else if (command == "value")
+			args >> value;
+	}
+
+	Search *search = &session->search;
+	if (name == "MaxDepth") {
+		search->set_max_depth((uint8_t) std::stoi(value));
+	} else if (name == "MultiPV") {
+		search->set_multi_pv((uint8_t) std::stoi(value));
+	} else if (name == "Evaluator") {
+		bool available = false;
+		if (value == "classic")
+			available = search->set_evaluator(CLASSIC);
+		else if (value == "pattern")
+			available = search->set_evaluator(PATTERN);
+		else if (value == "nnue")
+			available = search->set_evaluator(NNUE);
+		if (!available)
+			std::cerr << "Evaluator not available: " << value << std::endl;
+	} else if (name == "SolvedMinDepth") {
+		search->set_solved_min_depth((uint8_t) std::stoi(value));
+	} else if (name == "OwnBook") {
+		session->own_book = value == "true";
+	} else if (name == "LMRMinDepth") {
+		search->set_lmr_min_depth((uint8_t) std::stoi(value));
+	} else if (name == "LMRMinMove") {
+		search->set_lmr_min_move((uint8_t) std::stoi(value));
+	} else if (name == "LMREndgame") {
+		search->set_lmr_endgame((uint8_t) std::stoi(value));
+	} else if (name == "LMRBase") {
+		search->set_lmr_base(std::stod(value));
+	} else if (name == "LMRDivisor") {
+		search->set_lmr_divisor(std::stod(value));
+	} else {
+		std::cerr << "Unrecognized option: " << name << std::endl;
+	}
+}
+
+static void execute(session_t *session, const std::string &line) {
+	std::istringstream args(line);
+	std::string command;
+	args >> command;
+
+	if (command == "go")
+		go(session, args);
+	else if (command == "play")
+		play(session, args);
+	else if (command == "position")
+		set_position(session, args);
+	else if (command == "setoption")
+		set_option(session, args);
+	else if (command == "close")
+		session->closed = true;
+	else
+		std::cerr << "Unrecognized command: " << command << std::endl;
+}
+
+/**
+ * Runs the waiting commands of the session in order, until a go has to wait
+ * for its search
+ */
+static void run_commands(session_t *session) {
+	while (!session->busy && !session->backlog.empty()) {
+		std::string line = session->backlog.front();
+		session->backlog.pop_front();
+		execute(session, line);
+
+		if (session->closed) {
+			std::string name = session->name;
+			sessions.erase(name);
+			return;
+		}
+	}
+}
+
+static void worker(void) {
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (true) {
+		work.wait(guard, []() { return quitting || !requests.empty(); });
+		if (requests.empty())
+			return;
+
+		request_t request = requests.front();
+		requests.pop_front();
+		session_t *session = request.session;
+
+		// The halves have a fixed size and are never cleared. Every search
+		// ages its half, so the boards of finished games are replaced first.
+		uint8_t parity = count(~(session->board.player | session->board.opponent)) % 2;
+
+		// The clock of the session has been running since its go arrived
+		search_limits_t limits = request.limits;
+		uint64_t waited_ms = get_time_ms() - request.received_ms;
+		if (limits.move_time_ms > 0)
+			limits.move_time_ms = limits.move_time_ms > waited_ms ? limits.move_time_ms - waited_ms : 1;
+		else
+			limits.remaining_ms = limits.remaining_ms > waited_ms ? limits.remaining_ms - waited_ms : 0;
+
+		// The search is prepared under the lock, so a stop can not get lost
+		// between the start of the search and the search itself. The worker
+		// searches itself, without the lock.
+		session->search.set_table(&tables[parity]);
+		session->search.set_position(session->board);
+		session->search.prepare(&limits);
+		if (session->stopped)
+			session->search.stop();
+
+		guard.unlock();
+		int8_t move = session->search.run();
+		guard.lock();
+
+		session->busy = false;
+		finish_go(session, move);
+		run_commands(session);
+	}
+}
+
+static void usage(void) {
+	std::cerr << "Usage: ./server.out [--threads <n>] [--hash <MB>] [--patterns <weights>]\n"
+			"                   [--nnue <network>] [--book <book>] [--solved <log>]" << std::endl;
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *pattern_file = DEFAULT_PATTERN_FILE;
+	const char *book_file = DEFAULT_BOOK_FILE;
+	const char *nnue_file = NULL;
+	const char *solved_file = NULL;
+
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "--threads") == 0)
+			threads = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--hash") == 0)
+			hash_mb = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--patterns") == 0)
+			pattern_file = argv[i + 1];
+		else if (strcmp(argv[i], "--nnue") == 0)
+			nnue_file = argv[i + 1];
+		else if (strcmp(argv[i], "--book") == 0)
+			book_file = argv[i + 1];
+		else if (strcmp(argv[i], "--solved") == 0)
+			solved_file = argv[i + 1];
+		else
+			usage();
+	}
+
+	if (threads < 1)
+		usage();
+
+	use_patterns = load_patterns(pattern_file);
+	load_book(book_file);
+	if (nnue_file != NULL && !load_nnue(nnue_file))
+		std::cerr << "Could not load network: " << nnue_file << std::endl;
+	if (solved_file != NULL && !open_solved(solved_file))
+		std::cerr << "Could not open solved position log: " << solved_file << std::endl;
+
+	for (eval_map_t &table : tables) {
+		table.shared = true;
+		set_map_size(&table, hash_mb / 2);
+		init_map(&table);
+	}
+
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < threads; ++i)
+		workers.push_back(std::thread(worker));
+
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		std::istringstream args(line);
+		std::string name, command;
+		if (!(args >> name))
+			continue;
+
+		if (name == "isready") {
+			std::lock_guard<std::mutex> guard(output_lock);
+			std::cout << "readyok" << std::endl;
+			continue;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+
+		// Every search reports its move, commands that did not run yet are dropped
+		if (name == "quit") {
+			for (auto &entry : sessions) {
+				entry.second->backlog.clear();
+				if (entry.second->busy) {
+					entry.second->stopped = true;
+					entry.second->search.stop();
+				}
+			}
+			break;
+		}
+
+		session_t *session = open_session(name);
+		args >> command;
+		if (command == "stop") {
+			if (session->busy) {
+				session->stopped = true;
+				session->search.stop();
+			}
+			continue;
+		}
+
+		size_t start = line.find(command, line.find(name) + name.size());
+		session->backlog.push_back(line.substr(start));
+		run_commands(session);
+	}
+
+	// At the end of the input, the searches that are left still report their moves
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quitting = true;
+	}
+	work.notify_all();
+	for (std::thread &thread : workers)
+		thread.join();
+
+	sessions.clear();
+	for (eval_map_t &table : tables)
+		free_map(&table);
+
+	return 0;
+}
@@ -0,0 +1,291 @@
+#include "solved.hpp"
+
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(solved_header_t) == 16, "The header is stored as it is in memory");
+static_assert(sizeof(solved_entry_t) == 32, "Records are stored as they are in memory");
+
+#define INDEX_MIN_SIZE 1024
+
+// Searches on different threads share the log and its index
+static std::mutex log_lock;
+
+static char *log_path = NULL;
+static int log_fd = -1;
+// flock locks belong to the open file, which a forked child shares with its
+// parent, so a child opens the log again before it uses it
+static pid_t owner = 0;
+
+static const char *log_data = NULL;
+static size_t mapped_size = 0;
+
+// Open addressing table of record numbers plus one, 0 marks an empty slot
+static uint32_t *index_slots = NULL;
+static uint64_t index_size = 0;
+static uint64_t nr_indexed = 0;
+
+static const solved_entry_t *records(void) {
+	return (const solved_entry_t *) (log_data + sizeof(solved_header_t));
+}
+
+/**
+ * Whether a is at least as good as b: an exact result beats any search that
+ * stopped early, and otherwise the deepest search wins
+ */
+static bool at_least_as_good(uint8_t exact_a, uint8_t depth_a, uint8_t exact_b, uint8_t depth_b) {
+	if (exact_a != exact_b)
+		return exact_a;
+	return depth_a >= depth_b;
+}
+
+/**
+ * The slot of the position and settings: a position has a slot for its exact
+ * record, and one for the records of every settings
+ */
+static uint64_t find_slot(uint64_t player, uint64_t opponent, uint32_t settings) {
+	board_t board = {.player = player, .opponent = opponent};
+	uint64_t mask = index_size - 1;
+	uint64_t slot = (hash_board(board) + settings) & mask;
+
+	while (index_slots[slot] != 0) {
+		const solved_entry_t *entry = &records()[index_slots[slot] - 1];
+		if (entry->player == player && entry->opponent == opponent && entry->settings == settings)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static void index_record(uint32_t record) {
+	const solved_entry_t *entry = &records()[record];
+	uint64_t slot = find_slot(entry->player, entry->opponent, entry->settings);
+
+	if (index_slots[slot] == 0) {
+		index_slots[slot] = record + 1;
+		return;
+	}
+
+	// Later records of the same quality replace earlier ones
+	const solved_entry_t *current = &records()[index_slots[slot] - 1];
+	if (at_least_as_good(entry->exact, entry->depth, current->exact, current->depth))
+		index_slots[slot] = record + 1;
+}
+
+static void resize_index(uint64_t size) {
+	uint32_t *old_slots = index_slots;
+	uint64_t old_size = index_size;
+
+	index_slots = (uint32_t *) calloc(size, sizeof(uint32_t));
+	index_size = size;
+
+	for (uint64_t i = 0; i < old_size; ++i) {
+		if (old_slots[i] != 0)
+			index_record(old_slots[i] - 1);
+	}
+	free(old_slots);
+}
+
+static void unmap_log(void) {
+	if (log_data != NULL)
+		munmap((void *) log_data, mapped_size);
+	log_data = NULL;
+	mapped_size = 0;
+}
+
+static bool open_log(const char *path);
+
+/**
+ * Maps the log again when another process or we ourselves appended to it,
+ * and indexes the new records
+ */
+static bool refresh(void) {
+	if (log_fd < 0)
+		return false;
+
+	if (owner != getpid()) {
+		char *path = strdup(log_path);
+		bool ok = open_log(path);
+		free(path);
+		if (!ok)
+			return false;
+	}
+
+	struct stat st;
+	if (fstat(log_fd, &st) != 0 || st.st_size < (off_t) sizeof(solved_header_t))
+		return false;
+
+	// A record that is being written, or that was torn by a crash, is left
+	// out until it is complete
+	uint64_t nr_records = (st.st_size - sizeof(solved_header_t)) / sizeof(solved_entry_t);
+	if (nr_records == nr_indexed)
+		return true;
+
+	size_t size = sizeof(solved_header_t) + nr_records * sizeof(solved_entry_t);
+	const void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, log_fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+
+	unmap_log();
+	log_data = (const char *) data;
+	mapped_size = size;
+
+	if (index_size < 2 * nr_records) {
+		uint64_t new_size = index_size > 0 ? index_size : INDEX_MIN_SIZE;
+		while (new_size < 2 * nr_records)
+			new_size *= 2;
+		resize_index(new_size);
+	}
+
+	for (; nr_indexed < nr_records; ++nr_indexed)
+		index_record(nr_indexed);
+	return true;
+}
+
+static void close_log(void) {
+	unmap_log();
+	if (log_fd >= 0)
+		close(log_fd);
+	log_fd = -1;
+	free(log_path);
+	log_path = NULL;
+
+	free(index_slots);
+	index_slots = NULL;
+	index_size = 0;
+	nr_indexed = 0;
+}
+
+static bool open_log(const char *path) {
+	close_log();
+
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return false;
+
+	// Whoever gets the lock first writes the header of a new log
+	flock(fd, LOCK_EX);
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok && st.st_size < (off_t) sizeof(solved_header_t)) {
+		solved_header_t header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, SOLVED_MAGIC, sizeof(header.magic));
+		header.version = SOLVED_VERSION;
+		ok = ftruncate(fd, 0) == 0 && write(fd, &header, sizeof(header)) == sizeof(header);
+	}
+
+	solved_header_t header;
+	ok = ok && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+		&& strncmp(header.magic, SOLVED_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == SOLVED_VERSION;
+	flock(fd, LOCK_UN);
+
+	if (!ok) {
+		fprintf(stderr, "ERROR: %s is not a valid solved position log\n", path);
+		close(fd);
+		return false;
+	}
+
+	log_fd = fd;
+	log_path = strdup(path);
+	owner = getpid();
+	return refresh();
+}
+
+bool open_solved(const char *path) {
+	std::lock_guard<std::mutex> lock(log_lock);
+	return open_log(path);
+}
+
+void close_solved(void) {
+	std::lock_guard<std::mutex> lock(log_lock);
+	close_log();
+}
+
+bool solved_opened(void) {
+	std::lock_guard<std::mutex> lock(log_lock);
+	return log_fd >= 0;
+}
+
+bool find_solved(board_t board, uint32_t settings, solved_entry_t *entry) {
+	std::lock_guard<std::mutex> lock(log_lock);
+	if (!refresh() || index_size == 0)
+		return false;
+
+	uint8_t symmetry;
+	board_t canonical = canonical_board(board, &symmetry);
+	uint64_t slot = find_slot(canonical.player, canonical.opponent, SOLVED_ANY_SETTINGS);
+	if (index_slots[slot] == 0)
+		slot = find_slot(canonical.player, canonical.opponent, settings);
+	if (index_slots[slot] == 0)
+		return false;
+
+	*entry = records()[index_slots[slot] - 1];
+
+	// The move is stored on the canonical board, find the move on our board
+	// that ends up on the same square
+	uint64_t valid = get_valid_moves(board);
+	for (uint8_t i = 0; i < 64; ++i) {
+		if (is_set(valid, i) && transform_square(i, symmetry) == entry->move) {
+			entry->move = i;
+			entry->player = board.player;
+			entry->opponent = board.opponent;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool store_solved(board_t board, uint8_t move, double score, uint8_t depth, bool exact, uint32_t settings) {
+	std::lock_guard<std::mutex> lock(log_lock);
+	if (!refresh())
+		return false;
+
+	uint8_t symmetry;
+	board_t canonical = canonical_board(board, &symmetry);
+
+	solved_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.player = canonical.player;
+	entry.opponent = canonical.opponent;
+	entry.score = score;
+	entry.move = transform_square(move, symmetry);
+	entry.depth = depth;
+	entry.exact = exact;
+	entry.settings = exact ? SOLVED_ANY_SETTINGS : settings;
+
+	if (index_size > 0) {
+		// Nothing beats an exact record
+		uint64_t slot = find_slot(entry.player, entry.opponent, SOLVED_ANY_SETTINGS);
+		if (index_slots[slot] == 0)
+			slot = find_slot(entry.player, entry.opponent, entry.settings);
+		if (index_slots[slot] != 0) {
+			const solved_entry_t *current = &records()[index_slots[slot] - 1];
+			if (at_least_as_good(current->exact, current->depth, entry.exact, entry.depth))
+				return false;
+		}
+	}
+
+	flock(log_fd, LOCK_EX);
+
+	// Cut off a record that was torn by a crash, so ours starts on a record
+	// boundary
+	struct stat st;
+	bool ok = fstat(log_fd, &st) == 0;
+	off_t tail = ok ? (st.st_size - sizeof(solved_header_t)) % sizeof(solved_entry_t) : 0;
+	if (ok && tail != 0)
+		ok = ftruncate(log_fd, st.st_size - tail) == 0;
+
+	ok = ok && write(log_fd, &entry, sizeof(entry)) == sizeof(entry);
+	flock(log_fd, LOCK_UN);
+
+	return ok && refresh();
+}
@@ -0,0 +1,75 @@
+#ifndef SOLVED_H
+#define SOLVED_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "../lib/state_t.hpp"
+
+/**
+ * Persistent cache of solved and deeply searched positions. The cache is an
+ * append-only log of canonical positions (see canonical_board) that is mapped
+ * into memory, with an index from the position to its best record that is
+ * built when the log is opened and extended whenever the log grows. Several
+ * processes may read and append to the same log, appends are serialized with
+ * a lock on the file. Within a process, the searches of all threads share the
+ * log.
+ *
+ * An exact result holds for every search. The result of a search that stopped
+ * early depends on how it searched, so those records carry the settings of
+ * their search, and are only found by searches with the same settings.
+ */
+
+#define SOLVED_MAGIC "OOOOSLV"
+#define SOLVED_VERSION 2
+
+// The settings of exact records
+#define SOLVED_ANY_SETTINGS 0
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+} solved_header_t;
+
+typedef struct {
+	uint64_t player;     // The canonical board, the player is to move
+	uint64_t opponent;
+	double score;        // Score of the best move for the player to move
+	uint8_t move;        // Best move on the canonical board
+	uint8_t depth;       // Depth of the search
+	uint8_t exact;       // Whether the search read the game out to the end
+	uint8_t reserved;
+	uint32_t settings;   // Of the search, SOLVED_ANY_SETTINGS if exact
+} solved_entry_t;
+
+/**
+ * Opens the log at the given path, and creates it when it does not exist
+ *
+ * @return Whether the file is a valid log
+ */
+bool open_solved(const char *path);
+void close_solved(void);
+bool solved_opened(void);
+
+/**
+ * Looks up the board. Of all records of the position, the exact one or else
+ * the deepest one of a search with the settings is returned.
+ *
+ * @param[in] The board, in any orientation
+ * @param[in] The settings of the search that looks, never SOLVED_ANY_SETTINGS
+ * @param[out] The record, with the move on the given board instead of the canonical board
+ * @return Whether the position is in the log
+ */
+bool find_solved(board_t board, uint32_t settings, solved_entry_t *entry);
+
+/**
+ * Appends the result of a search of the board to the log, unless the log
+ * already holds a result that is at least as good. Exact results are stored
+ * for any settings.
+ *
+ * @return Whether the result was appended
+ */
+bool store_solved(board_t board, uint8_t move, double score, uint8_t depth, bool exact, uint32_t settings);
+
+#endif
@@ -9,10 +9,14 @@
 #include "../ai/ai.hpp"
 #include "../lib/debug.hpp"
 #include "../lib/state_t.hpp"
-#include "../lib/eval_hashmap.hpp"
+#include "../lib/eval_cache.hpp"
 
 #define TIME_LIMIT 60
 
+// The random opponent is seeded with a constant. The engine still searches on
+// time, so for numbers that can be reproduced exactly, see suite.cpp.
+#define SEED 1
+
 typedef enum {
 	AI, RANDOM
 } player_t;
@@ -92,12 +96,11 @@ void play(void) {
 int main(void) {
 	setlocale(LC_CTYPE, "");
 
-	// Replace time(NULL) with a constant in order to get reproducible random AI moves
-	srand(time(NULL));
+	srand(SEED);
 
-	uint8_t win = 0;
-	uint8_t loss = 0;
-	uint8_t draw = 0;
+	uint64_t win = 0;
+	uint64_t loss = 0;
+	uint64_t draw = 0;
 
 	uint8_t opponent_score = 0;
 	uint8_t player_score = 0;
@@ -125,9 +128,9 @@ int main(void) {
 #endif
 	printf("Games/s: %.2f\n", (double) (win + loss + draw) / TIME_LIMIT);
 	printf("AI wins: %.2f%%\n", (((double) win) / (win + loss + draw)) * 100);
-	printf("Draws: %d\n", draw);
+	printf("Draws: %" PRIu64 "\n", draw);
 	print_ai_metrics();
-	print_hash_metrics();
+	print_eval_cache_metrics();
 	printf("```\n");
 
 	return 0;
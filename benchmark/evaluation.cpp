@@ -0,0 +1,211 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ai/evaluation.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../lib/state_t.hpp"
+
+#define POSITIONS 200000
+#define ROUNDS 50
+
+// Timings cycle through a slice of the positions that fits in the cache. In
+// the search the state of a leaf was just written by its parent, timing it
+// straight from memory would only measure memory bandwidth.
+#define WORKING_SET 1024
+
+static board_t positions[POSITIONS];
+static eval_state_t states[POSITIONS];
+
+// The move that was played from every position, and the discs it flipped.
+// Positions that were passed from, or end the game, have move 64.
+static uint8_t moves[POSITIONS];
+static uint64_t flips[POSITIONS];
+
+static uint8_t tracked = 0;
+
+/**
+ * Fills the positions with every position of random games, so all stages of
+ * the game are covered. The evaluation state is updated along the way, the
+ * way the search does.
+ */
+static void generate_positions(void) {
+	uint32_t n = 0;
+	while (n < POSITIONS) {
+		board_t board;
+		board.player = 0b0000000000000000000000000000100000010000000000000000000000000000;
+		board.opponent = 0b0000000000000000000000000001000000001000000000000000000000000000;
+
+		eval_state_t state;
+		init_eval_state(&state, board, tracked);
+
+		bool skipped = false;
+		while (n < POSITIONS) {
+			uint64_t valid = get_valid_moves(board);
+			if (valid == 0) {
+				if (skipped)
+					break;
+				skipped = true;
+				switch_boards(&board);
+				switch_eval_state(&state);
+				continue;
+			}
+			skipped = false;
+
+			for (int choice = rand() % count(valid); choice > 0; --choice)
+				valid &= valid - 1;
+			uint8_t move = __builtin_ctzll(valid);
+
+			board_t new_board = board;
+			do_move(&new_board, move);
+			uint64_t flipped = board.opponent & ~new_board.opponent;
+			if (n > 0 && moves[n - 1] == 64 && positions[n - 1].player == board.player && positions[n - 1].opponent == board.opponent) {
+				moves[n - 1] = move;
+				flips[n - 1] = flipped;
+			}
+
+			update_eval_state(&state, move, flipped);
+			switch_boards(&new_board);
+			board = new_board;
+
+			positions[n] = board;
+			states[n] = state;
+			moves[n] = 64;
+			n++;
+		}
+	}
+}
+
+static bool same_state(const eval_state_t *a, const eval_state_t *b) {
+	uint8_t i = a->side;
+	uint8_t j = b->side;
+	bool same = a->weight_score[i] == b->weight_score[j] && a->weight_score[i ^ 1] == b->weight_score[j ^ 1]
+		&& a->discs[i] == b->discs[j] && a->discs[i ^ 1] == b->discs[j ^ 1]
+		&& a->corners[i] == b->corners[j] && a->corners[i ^ 1] == b->corners[j ^ 1];
+	if (tracked & TRACK_PATTERNS)
+		same &= memcmp(a->pattern_indices[i], b->pattern_indices[j], sizeof(a->pattern_indices[i])) == 0
+			&& memcmp(a->pattern_indices[i ^ 1], b->pattern_indices[j ^ 1], sizeof(a->pattern_indices[i])) == 0;
+	if (tracked & TRACK_NNUE)
+		same &= memcmp(a->accumulators[i], b->accumulators[j], sizeof(a->accumulators[i])) == 0
+			&& memcmp(a->accumulators[i ^ 1], b->accumulators[j ^ 1], sizeof(a->accumulators[i])) == 0;
+	return same;
+}
+
+static double reference(uint32_t i) {
+	return reference_evaluation(positions[i]);
+}
+
+static double classic(uint32_t i) {
+	return classic_evaluation(positions[i]);
+}
+
+static double classic_incremental(uint32_t i) {
+	return classic_evaluation_state(positions[i], &states[i]);
+}
+
+static double pattern(uint32_t i) {
+	return pattern_evaluation(positions[i]);
+}
+
+static double pattern_incremental(uint32_t i) {
+	const eval_state_t *state = &states[i];
+	return pattern_evaluation_indices(state->pattern_indices[state->side], count(~(positions[i].player | positions[i].opponent)));
+}
+
+static double nnue(uint32_t i) {
+	return nnue_evaluation(positions[i]);
+}
+
+static double nnue_incremental(uint32_t i) {
+	const eval_state_t *state = &states[i];
+	return nnue_evaluation_accumulators(state->accumulators[state->side], state->accumulators[state->side ^ 1]);
+}
+
+static double update(uint32_t i) {
+	eval_state_t state;
+	copy_eval_state(&state, &states[i]);
+	if (moves[i] < 64)
+		update_eval_state(&state, moves[i], flips[i]);
+	return state.weight_score[0];
+}
+
+static double time_ns(double (*function)(uint32_t)) {
+	struct timespec start, end;
+	volatile double sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t offset = 0; offset < POSITIONS; offset += WORKING_SET)
+		for (uint8_t round = 0; round < ROUNDS; ++round)
+			for (uint32_t i = offset; i < offset + WORKING_SET && i < POSITIONS; ++i)
+				sum += function(i);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double ns = (end.tv_sec - start.tv_sec) * 1.0e9 + (end.tv_nsec - start.tv_nsec);
+	return ns / ((double) POSITIONS * ROUNDS);
+}
+
+int main(int argc, char *argv[]) {
+	// The pattern and network evaluations are only compared when their
+	// weights are given
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "--patterns") == 0 && load_patterns(argv[i + 1])) {
+			tracked |= TRACK_PATTERNS;
+		} else if (strcmp(argv[i], "--nnue") == 0 && load_nnue(argv[i + 1])) {
+			tracked |= TRACK_NNUE;
+		} else {
+			fprintf(stderr, "Usage: ./evaluation.out [--patterns <weights>] [--nnue <network>]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Fixed seed, every run evaluates the same positions
+	srand(42);
+	generate_positions();
+
+	uint32_t mismatches = 0;
+	for (uint32_t i = 0; i < POSITIONS; ++i) {
+		double expected = reference_evaluation(positions[i]);
+		bool same = classic_evaluation(positions[i]) == expected
+			&& classic_incremental(i) == expected;
+
+		eval_state_t scratch;
+		init_eval_state(&scratch, positions[i], tracked);
+		same &= same_state(&scratch, &states[i]);
+
+		if (tracked & TRACK_PATTERNS)
+			same &= pattern_incremental(i) == pattern(i);
+		if (tracked & TRACK_NNUE)
+			same &= nnue_incremental(i) == nnue(i);
+
+		if (!same && mismatches++ < 10)
+			printf("Mismatch on %" PRIu64 " %" PRIu64 "\n", positions[i].player, positions[i].opponent);
+	}
+
+	printf("```\n");
+	printf("EVALUATION:\n");
+	printf("    Positions: %d\n", POSITIONS);
+	printf("    Mismatches: %" PRIu32 "\n", mismatches);
+
+	double reference_ns = time_ns(reference);
+	double classic_ns = time_ns(classic);
+	double incremental_ns = time_ns(classic_incremental);
+	printf("    Reference ns/eval: %.2f\n", reference_ns);
+	printf("    Classic ns/eval: %.2f (%.2fx)\n", classic_ns, reference_ns / classic_ns);
+	printf("    Classic incremental ns/leaf: %.2f (%.2fx)\n", incremental_ns, reference_ns / incremental_ns);
+	if (tracked & TRACK_PATTERNS) {
+		printf("    Pattern ns/eval: %.2f\n", time_ns(pattern));
+		printf("    Pattern incremental ns/leaf: %.2f\n", time_ns(pattern_incremental));
+	}
+	if (tracked & TRACK_NNUE) {
+		printf("    NNUE ns/eval: %.2f\n", time_ns(nnue));
+		printf("    NNUE incremental ns/leaf: %.2f\n", time_ns(nnue_incremental));
+	}
+	printf("    State update ns/move: %.2f\n", time_ns(update));
+	printf("```\n");
+
+	return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,19 @@
+#include "positions.hpp"
+
+const suite_position_t suite[] = {
+	{"opening-1", {0x0000400030200000ULL, 0x0000387808080800ULL}, MIDGAME_DEPTH},
+	{"opening-2", {0x0000c00820200000ULL, 0x00402030181c0000ULL}, MIDGAME_DEPTH},
+	{"opening-3", {0x1000101808040000ULL, 0x20106c0030000000ULL}, MIDGAME_DEPTH},
+	{"midgame-1", {0x00086868e8c88000ULL, 0x4030101010300e00ULL}, MIDGAME_DEPTH},
+	{"midgame-2", {0x0000f020001c2220ULL, 0x0040009cf8604810ULL}, MIDGAME_DEPTH},
+	{"midgame-3", {0x0000d00a30540000ULL, 0xbc542c140e000000ULL}, MIDGAME_DEPTH},
+	{"midgame-4", {0x00706878c8e89008ULL, 0x4408900030100e04ULL}, MIDGAME_DEPTH},
+	{"midgame-5", {0x0000b0889cac8280ULL, 0x0040407460506870ULL}, MIDGAME_DEPTH},
+	{"midgame-6", {0x0001d2140c400000ULL, 0xbc542c2a323c0400ULL}, MIDGAME_DEPTH},
+	{"endgame-1", {0x004082c22a1e0802ULL, 0xff9f7d3d15618604ULL}, 0},
+	{"endgame-2", {0xe0e0e0b8b880973eULL, 0x0c181e47447c68c0ULL}, 0},
+	{"endgame-3", {0x2002e7c2ffb4f884ULL, 0x8079183c004b0371ULL}, 0},
+	{"endgame-4", {0x0060f2ea2e1e0800ULL, 0xff9f0d1511618607ULL}, 0},
+};
+
+const size_t nr_suite_positions = sizeof(suite) / sizeof(suite[0]);
@@ -0,0 +1,24 @@
+#ifndef POSITIONS_H
+#define POSITIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../lib/state_t.hpp"
+
+/**
+ * The fixed positions of the benchmarks. They are taken from three random
+ * games (xorshift64*, seeded 1, 2 and 3), at fixed numbers of empty squares.
+ */
+typedef struct {
+	const char *name;
+	board_t board;
+	uint8_t depth;            // 0 to read the game out to the end
+} suite_position_t;
+
+#define MIDGAME_DEPTH 7
+
+extern const suite_position_t suite[];
+extern const size_t nr_suite_positions;
+
+#endif
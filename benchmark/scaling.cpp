@@ -0,0 +1,225 @@
+#include <inttypes.h>
+#include <math.h>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../ai/ai.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../lib/eval_cache.hpp"
+#include "../lib/state_t.hpp"
+#include "positions.hpp"
+
+/**
+ * Measures how the parallel search scales. The suite of positions (see
+ * positions.hpp) is searched with 1, 2, 4, ... threads, up to the number of
+ * processors, every position with a fresh table and an empty evaluation
+ * cache. The run with one thread is the reference for:
+ *
+ * - the NPS speedup, the nodes per second over those of one thread
+ * - the time to depth speedup, how much sooner the depth of every position is
+ *   completed. Every thread of the parallel search searches one depth deeper
+ *   than the last, so an iteration with n threads completes depths d up to
+ *   d + n - 1. The time to depth is that of the first iteration that
+ *   completes at least the depth of the position.
+ * - the search overhead, the extra nodes searched until then
+ *
+ * The mean of the deepest completed iterations shows how far past their
+ * depths the positions were searched.
+ *
+ * The contention of the table is the number of times a thread had to wait
+ * for its lock, and the share of the time of all threads spent waiting.
+ *
+ * With --pin, thread i of the search runs on the i-th processor the process
+ * may use. That relies on OpenMP reusing the threads of its team, which
+ * libgomp does, the threads are pinned again before every search.
+ */
+
+typedef struct {
+	uint64_t nodes;
+	double time_ms;
+	uint64_t depth_nodes;     // Until the depth of the position was completed
+	double depth_ms;
+	uint8_t depth;            // Deepest completed iteration
+	uint64_t contended;
+	uint64_t wait_ns;
+} run_t;
+
+// Of the position that is searched
+static uint8_t target_depth;
+static run_t *current;
+static struct timespec start;
+
+static std::vector<int> cpus;
+
+static double elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1.0e6;
+}
+
+static void collect_iteration(const search_info_t *info) {
+	if (current->depth_ms < 0 && info->depth >= target_depth) {
+		current->depth_ms = elapsed_ms(&start);
+		current->depth_nodes = info->nodes;
+	}
+}
+
+/**
+ * The processors this process may run on
+ */
+static void find_cpus(void) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+		}
+	}
+	if (cpus.empty())
+		cpus.push_back(0);
+}
+
+/**
+ * Sets the number of threads of the next searches, and pins every thread to
+ * a processor of its own, or lets it run on all of them.
+ */
+static void set_threads(unsigned threads, bool pin) {
+	omp_set_dynamic(0);
+	omp_set_num_threads(threads);
+
+#pragma omp parallel
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (pin) {
+			CPU_SET(cpus[omp_get_thread_num() % cpus.size()], &set);
+		} else {
+			for (int cpu : cpus)
+				CPU_SET(cpu, &set);
+		}
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+}
+
+static run_t search_position(const suite_position_t *position, uint8_t midgame_depth, evaluator_t evaluator) {
+	uint8_t empties = count(~(position->board.player | position->board.opponent));
+	search_limits_t limits = {.move_time_ms = 0, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+	limits.max_depth = target_depth = position->depth > 0 ? midgame_depth : empties;
+
+	run_t run = {};
+	run.depth_ms = -1;
+	current = &run;
+
+	Search search;
+	search.set_evaluator(evaluator);
+	search.set_info_callback(collect_iteration);
+	search.set_position(position->board);
+	clear_eval_cache();
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	search.run(&limits);
+	run.time_ms = elapsed_ms(&start);
+
+	search_stats_t stats = search.stats();
+	run.nodes = stats.nodes;
+	run.depth = stats.depth;
+	run.contended = stats.table_contended;
+	run.wait_ns = stats.table_wait_ns;
+	if (run.depth_ms < 0) {
+		run.depth_ms = run.time_ms;
+		run.depth_nodes = run.nodes;
+	}
+	return run;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./scaling.out [--threads <n>] [--pin] [--depth <n>] [--patterns <weights>] [--nnue <network>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool pin = false;
+	uint8_t midgame_depth = MIDGAME_DEPTH;
+	evaluator_t evaluator = CLASSIC;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--pin") == 0) {
+			pin = true;
+		} else if (i + 1 >= argc) {
+			usage();
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			max_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--depth") == 0) {
+			midgame_depth = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--patterns") == 0 && load_patterns(argv[i + 1])) {
+			evaluator = PATTERN;
+			++i;
+		} else if (strcmp(argv[i], "--nnue") == 0 && load_nnue(argv[i + 1])) {
+			evaluator = NNUE;
+			++i;
+		} else {
+			usage();
+		}
+	}
+
+	if (max_threads < 1 || midgame_depth < 1)
+		usage();
+
+	find_cpus();
+	printf("%zu processors, %zu positions, %s\n", cpus.size(), nr_suite_positions, pin ? "pinned" : "not pinned");
+	if (pin && max_threads > cpus.size())
+		fprintf(stderr, "WARNING: more threads than processors, some share a processor\n");
+
+	std::vector<unsigned> thread_counts;
+	for (unsigned threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+
+	printf("%7s %12s %9s %9s %6s %7s %7s %9s %10s %7s\n", "threads", "nodes", "time s", "knps", "depth",
+			"nps x", "ttd x", "overhead", "waits/kn", "wait %");
+
+	run_t reference = {};
+	for (unsigned threads : thread_counts) {
+		set_threads(threads, pin);
+
+		run_t total = {};
+		double depths = 0;
+		for (size_t i = 0; i < nr_suite_positions; ++i) {
+			run_t run = search_position(&suite[i], midgame_depth, evaluator);
+			total.nodes += run.nodes;
+			total.time_ms += run.time_ms;
+			total.depth_nodes += run.depth_nodes;
+			total.depth_ms += run.depth_ms;
+			depths += run.depth;
+			total.contended += run.contended;
+			total.wait_ns += run.wait_ns;
+		}
+
+		if (threads == 1)
+			reference = total;
+
+		double time_ms = fmax(total.time_ms, 1e-3);
+		double nps = total.nodes / time_ms * 1000;
+		double reference_nps = reference.nodes / fmax(reference.time_ms, 1e-3) * 1000;
+		printf("%7u %12" PRIu64 " %9.3f %9.0f %6.2f %7.2f %7.2f %8.1f%% %10.3f %6.2f%%\n", threads, total.nodes,
+				total.time_ms / 1000, nps / 1000, depths / nr_suite_positions,
+				nps / fmax(reference_nps, 1e-3),
+				reference.depth_ms / fmax(total.depth_ms, 1e-3),
+				100.0 * ((double) total.depth_nodes / fmax(reference.depth_nodes, 1) - 1),
+				1000.0 * total.contended / fmax(total.nodes, 1),
+				100.0 * total.wait_ns / 1.0e6 / (time_ms * threads));
+		fflush(stdout);
+	}
+
+	return 0;
+}
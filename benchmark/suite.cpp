@@ -0,0 +1,200 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "../ai/ai.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../ai/protocol.hpp"
+#include "../lib/eval_cache.hpp"
+#include "../lib/state_t.hpp"
+#include "positions.hpp"
+
+/**
+ * Searches the fixed suite of positions (see positions.hpp) to a fixed depth,
+ * every position with an empty table and an empty evaluation cache. In the
+ * serial build the number of nodes only changes when the search itself
+ * changes, so the total is a signature of the search, and the times can be
+ * compared between builds. The results are printed as JSON.
+ *
+ * Built with PERF, every position also gets the hardware counters of its
+ * search, per node, or null where there are none. Built with TRACE, the
+ * searches are traced to the file given with --trace (see trace.hpp).
+ *
+ * The positions share one table of --hash MB, that is cleared between them,
+ * so the time to allocate it and to fault its pages in is not counted.
+ */
+
+typedef struct {
+	uint8_t depth;
+	uint64_t nodes;
+	uint64_t time_ms;
+	double ebf;
+} iteration_t;
+
+static std::vector<iteration_t> iterations;
+
+static void collect_iteration(const search_info_t *info) {
+	iterations.push_back({info->depth, info->nodes, info->time_ms, info->ebf});
+}
+
+static double elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1.0e6;
+}
+
+#ifdef PERF
+static const char *perf_keys[PERF_EVENTS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+static void print_perf(const search_stats_t *stats) {
+	if (perf_error() != NULL) {
+		printf("null");
+		return;
+	}
+
+	const uint64_t *values = stats->perf.values;
+	double nodes = fmax(stats->nodes, 1);
+	if (perf_available(PERF_CYCLES) && perf_available(PERF_INSTRUCTIONS))
+		printf("{\"ipc\": %.3f", (double) values[PERF_INSTRUCTIONS] / fmax(values[PERF_CYCLES], 1));
+	else
+		printf("{\"ipc\": null");
+	for (uint8_t event = 0; event < PERF_EVENTS; ++event) {
+		if (perf_available((perf_event_t) event))
+			printf(", \"%s_per_node\": %.3f", perf_keys[event], values[event] / nodes);
+	}
+	printf("}");
+}
+#endif
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./suite.out [--depth <n>] [--nodes <n>] [--patterns <weights>] [--nnue <network>] [--trace <file>]\n"
+			"                   [--hash <MB>] [--huge-pages on|off]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	uint8_t midgame_depth = MIDGAME_DEPTH;
+	uint64_t max_nodes = 0;
+	evaluator_t evaluator = CLASSIC;
+	const char *evaluator_name = "classic";
+	const char *trace_path = NULL;
+	size_t hash_mb = 0;
+
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "--depth") == 0) {
+			midgame_depth = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "--nodes") == 0) {
+			max_nodes = strtoull(argv[i + 1], NULL, 10);
+		} else if (strcmp(argv[i], "--patterns") == 0 && load_patterns(argv[i + 1])) {
+			evaluator = PATTERN;
+			evaluator_name = "pattern";
+		} else if (strcmp(argv[i], "--nnue") == 0 && load_nnue(argv[i + 1])) {
+			evaluator = NNUE;
+			evaluator_name = "nnue";
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			trace_path = argv[i + 1];
+		} else if (strcmp(argv[i], "--hash") == 0) {
+			hash_mb = strtoull(argv[i + 1], NULL, 10);
+		} else if (strcmp(argv[i], "--huge-pages") == 0 && (strcmp(argv[i + 1], "on") == 0 || strcmp(argv[i + 1], "off") == 0)) {
+			set_huge_pages(strcmp(argv[i + 1], "on") == 0);
+		} else {
+			usage();
+		}
+	}
+
+	if (midgame_depth < 1)
+		usage();
+
+	printf("{\n");
+#ifdef PARALLEL
+	printf("  \"build\": \"parallel\",\n");
+#else
+	printf("  \"build\": \"serial\",\n");
+#endif
+	printf("  \"evaluator\": \"%s\",\n", evaluator_name);
+	printf("  \"positions\": [\n");
+
+	uint64_t total_nodes = 0;
+	double total_ms = 0;
+
+	// Only one search uses the table at a time, so it is not marked shared
+	eval_map_t table = {};
+	set_map_size(&table, hash_mb);
+	init_map(&table);
+
+	for (size_t i = 0; i < nr_suite_positions; ++i) {
+		const suite_position_t *position = &suite[i];
+		uint8_t empties = count(~(position->board.player | position->board.opponent));
+		uint8_t depth = position->depth > 0 ? midgame_depth : empties;
+
+		search_limits_t limits = {.move_time_ms = 0, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = max_nodes, .max_depth = depth, .infinite = false};
+
+		Search search;
+		search.set_evaluator(evaluator);
+		search.set_table(&table);
+		search.set_info_callback(collect_iteration);
+		search.set_position(position->board);
+		if (trace_path != NULL && !search.set_trace_file(trace_path)) {
+			fprintf(stderr, "Could not open trace file (or not built with TRACE): %s\n", trace_path);
+			return EXIT_FAILURE;
+		}
+		clear_map(&table);
+		clear_eval_cache();
+		iterations.clear();
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		int8_t move = search.run(&limits);
+		double time_ms = elapsed_ms(&start);
+
+		search_result_t result = search.result();
+		search_stats_t stats = search.stats();
+		total_nodes += stats.nodes;
+		total_ms += time_ms;
+
+		// Every position has moves, and the search reads passes and the end
+		// of the game out, so a score that is not finite is a bug
+		if (!finite_score(result.info.score)) {
+			fprintf(stderr, "The score of %s is not finite\n", position->name);
+			return EXIT_FAILURE;
+		}
+
+		printf("    {\"name\": \"%s\", \"empties\": %" PRIu8 ", \"depth\": %" PRIu8 ", ", position->name, empties, depth);
+		printf("\"move\": \"%s\", ", move >= 0 ? move_name(move).c_str() : "");
+		printf("\"score\": %.0f, ", result.info.score);
+		printf("\"nodes\": %" PRIu64 ", \"time_ms\": %.3f, \"nps\": %.0f,\n", stats.nodes, time_ms, stats.nodes / fmax(time_ms, 1e-3) * 1000);
+#ifdef PERF
+		printf("     \"perf\": ");
+		print_perf(&stats);
+		printf(",\n");
+#endif
+
+		// The time it took to complete every depth
+		printf("     \"iterations\": [");
+		for (size_t j = 0; j < iterations.size(); ++j) {
+			printf("%s{\"depth\": %" PRIu8 ", \"nodes\": %" PRIu64 ", \"time_ms\": %" PRIu64 ", \"ebf\": %.2f}", j > 0 ? ", " : "",
+					iterations[j].depth, iterations[j].nodes, iterations[j].time_ms, iterations[j].ebf);
+		}
+		printf("]}%s\n", i + 1 < nr_suite_positions ? "," : "");
+		fflush(stdout);
+	}
+
+	printf("  ],\n");
+	printf("  \"nodes\": %" PRIu64 ",\n", total_nodes);
+	printf("  \"time_ms\": %.3f,\n", total_ms);
+	printf("  \"nps\": %.0f\n", total_nodes / fmax(total_ms, 1e-3) * 1000);
+	printf("}\n");
+
+	free_map(&table);
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include "eval_cache.hpp"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	std::atomic<uint64_t> check;
+	std::atomic<uint64_t> value;
+} cache_entry_t;
+
+typedef struct cache {
+	cache_entry_t *entries = NULL;
+	uint64_t mask = 0;
+	uint64_t generation = 0;
+
+	~cache() {
+		free(entries);
+	}
+} cache_t;
+
+static size_t nr_entries = (EVAL_CACHE_DEFAULT_KB * 1024) / sizeof(cache_entry_t);
+static bool shared = false;
+
+// Bumped on every resize or clear. Thread caches compare it on each probe and
+// rebuild themselves lazily, so no thread has to touch another thread's cache.
+static std::atomic<uint64_t> generation(1);
+
+static cache_t shared_cache;
+static thread_local cache_t thread_cache;
+
+static void rebuild(cache_t *cache) {
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->mask = 0;
+
+	if (nr_entries > 0) {
+		cache->entries = (cache_entry_t *) aligned_alloc(64, nr_entries * sizeof(cache_entry_t));
+		if (cache->entries != NULL) {
+			memset((void *) cache->entries, 0, nr_entries * sizeof(cache_entry_t));
+			cache->mask = nr_entries - 1;
+		}
+	}
+	cache->generation = generation.load(std::memory_order_relaxed);
+}
+
+static cache_t *get_cache(void) {
+	if (shared)
+		return &shared_cache;
+
+	if (thread_cache.generation != generation.load(std::memory_order_relaxed))
+		rebuild(&thread_cache);
+	return &thread_cache;
+}
+
+void resize_eval_cache(size_t kilobytes) {
+	size_t entries = (kilobytes * 1024) / sizeof(cache_entry_t);
+
+	// Direct mapping needs a power of two to index with a mask
+	nr_entries = 0;
+	if (entries > 0)
+		nr_entries = (size_t) 1 << (63 - __builtin_clzll(entries));
+
+	clear_eval_cache();
+}
+
+void set_eval_cache_shared(bool s) {
+	shared = s;
+	clear_eval_cache();
+}
+
+void clear_eval_cache(void) {
+	generation++;
+
+	// The shared cache is rebuilt right away, between searches, so threads
+	// never race to build it
+	if (shared) {
+		rebuild(&shared_cache);
+	} else {
+		free(shared_cache.entries);
+		shared_cache.entries = NULL;
+		shared_cache.mask = 0;
+	}
+}
+
+bool probe_eval_cache(uint64_t hash, double *value) {
+	cache_t *cache = get_cache();
+	if (cache->entries == NULL)
+		return false;
+
+	cache_entry_t *entry = &cache->entries[hash & cache->mask];
+	uint64_t check = entry->check.load(std::memory_order_relaxed);
+	uint64_t bits = entry->value.load(std::memory_order_relaxed);
+
+	bool hit = (check ^ bits) == hash;
+	if (hit)
+		memcpy(value, &bits, sizeof(*value));
+	return hit;
+}
+
+void store_eval_cache(uint64_t hash, double value) {
+	cache_t *cache = get_cache();
+	if (cache->entries == NULL)
+		return;
+
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	cache_entry_t *entry = &cache->entries[hash & cache->mask];
+	entry->check.store(hash ^ bits, std::memory_order_relaxed);
+	entry->value.store(bits, std::memory_order_relaxed);
+}
+
+void print_eval_cache_metrics(void) {
+#ifdef METRICS
+	printf("EVAL CACHE:\n");
+	printf("    Size: %zu KB (%s)\n", nr_entries * sizeof(cache_entry_t) / 1024, shared ? "shared" : "per thread");
+#endif
+}
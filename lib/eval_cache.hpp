@@ -0,0 +1,59 @@
+#ifndef EVAL_CACHE_H
+#define EVAL_CACHE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A small direct-mapped cache of static evaluations, keyed by the hash of the
+ * position. Leaves that are reached through different move orders only have
+ * to be evaluated once. The cache is meant to fit in L2, so a probe is much
+ * cheaper than a heavy evaluation.
+ *
+ * Every entry stores the hash XOR-ed with the value next to the value. An
+ * entry torn by two threads writing at once no longer matches its hash and
+ * is simply a miss, so the cache needs no locks.
+ */
+
+#define EVAL_CACHE_DEFAULT_KB 256
+
+/**
+ * Sets the size of the cache, rounded down to a power of two entries.
+ * Clears the cache. A size of 0 disables it.
+ */
+void resize_eval_cache(size_t kilobytes);
+
+/**
+ * Chooses between one cache shared by all threads and a cache per thread.
+ * Clears the cache.
+ */
+void set_eval_cache_shared(bool shared);
+
+/**
+ * Forgets all evaluations, for instance because new weights were loaded.
+ * No search may use the cache meanwhile.
+ */
+void clear_eval_cache(void);
+
+/**
+ * Looks up the evaluation of a position
+ *
+ * @param[in] The hash of the position
+ * @param[out] The evaluation, only set on a hit
+ * @return Whether the position was in the cache
+ */
+bool probe_eval_cache(uint64_t hash, double *value);
+
+/**
+ * Stores the evaluation of a position, replacing whatever was in its slot
+ */
+void store_eval_cache(uint64_t hash, double value);
+
+/**
+ * Prints the size of the cache. Its hits and misses are counted by the
+ * threads of the searches that probe it, so they are in their statistics.
+ */
+void print_eval_cache_metrics(void);
+
+#endif
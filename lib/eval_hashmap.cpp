@@ -1,84 +1,320 @@
 #include "eval_hashmap.hpp"
 
-#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "debug.hpp"
 
-static board_eval_t *eval_hashmap = NULL;
+// Transparent huge pages on x86-64. The buckets are aligned to them, so none
+// of their huge pages straddles the start of the mapping.
+#define HUGE_PAGE_SIZE (2 << 20)
+
+static_assert(sizeof(board_eval_t) == 32, "Two boards fill a bucket");
+static_assert(sizeof(eval_bucket_t) == 64, "A bucket fills a cache line");
+
+static bool use_huge_pages = true;
+
+// A board that is a search older counts as this much shallower when a board
+// has to make room
+#define AGE_DEPTH_PENALTY 4
+
+// The threads of a parallel search share its map, and so do shared searches
+static bool needs_lock(const eval_map_t *map) {
 #ifdef PARALLEL
-static pthread_rwlock_t maplock;
+	(void) map;
+	return true;
+#else
+	return map->shared;
 #endif
+}
 
 #ifdef METRICS
-static uint64_t total_hits = 0;
-static uint64_t total_misses = 0;
+static uint64_t get_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Counts the waits for a lock that was taken by another thread. The lock is
+ * only tried first, so an uncontended lock costs next to nothing extra. The
+ * threads of a search count at the same time, so these are atomic.
+ */
+static void count_wait(eval_map_t *map, uint64_t start_ns) {
+	__atomic_fetch_add(&map->contended, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&map->wait_ns, get_time_ns() - start_ns, __ATOMIC_RELAXED);
+}
 #endif
 
-void add_eval(board_eval_t *eval) {
-#ifdef PARALLEL
-	pthread_rwlock_wrlock(&maplock);
+static void read_lock(eval_map_t *map) {
+#ifdef METRICS
+	if (pthread_rwlock_tryrdlock(&map->lock) != 0) {
+		uint64_t start_ns = get_time_ns();
+		pthread_rwlock_rdlock(&map->lock);
+		count_wait(map, start_ns);
+	}
+#else
+	pthread_rwlock_rdlock(&map->lock);
 #endif
-	HASH_ADD(hh, eval_hashmap, board, sizeof(board_t), eval);
-#ifdef PARALLEL
-	pthread_rwlock_unlock(&maplock);
+}
+
+static void write_lock(eval_map_t *map) {
+#ifdef METRICS
+	if (pthread_rwlock_trywrlock(&map->lock) != 0) {
+		uint64_t start_ns = get_time_ns();
+		pthread_rwlock_wrlock(&map->lock);
+		count_wait(map, start_ns);
+	}
+#else
+	pthread_rwlock_wrlock(&map->lock);
 #endif
 }
 
-board_eval_t *find_eval(board_t board) {
-	board_eval_t *eval;
+static inline bool same_board(const board_eval_t *entry, board_t board, uint8_t tag) {
+	return entry->board.player == board.player && entry->board.opponent == board.opponent && entry->tag == tag;
+}
 
-#ifdef PARALLEL
-	pthread_rwlock_rdlock(&maplock);
-#endif
-	HASH_FIND(hh, eval_hashmap, &board, sizeof(board_t), eval);
-#ifdef PARALLEL
-	pthread_rwlock_unlock(&maplock);
-#endif
+static inline eval_bucket_t *find_bucket(const eval_map_t *map, board_t board, uint8_t tag) {
+	return &map->buckets[(hash_board(board) + tag * EVAL_TAG_SALT) & map->mask];
+}
 
-#ifdef METRICS
-	if (eval == NULL)
-		total_misses++;
+/**
+ * How much a board is worth keeping: its depth, less a penalty for every
+ * search since it was stored. Ages wrap around, so a board of 256 searches
+ * ago counts as new again, but only until it is replaced.
+ */
+static inline int replace_priority(const eval_map_t *map, const board_eval_t *entry) {
+	uint8_t searches = map->age - entry->age;
+	return entry->depth - AGE_DEPTH_PENALTY * searches;
+}
+
+bool find_eval(eval_map_t *map, board_t board, uint8_t tag, board_eval_t *eval) {
+	if (map->buckets == NULL)
+		return false;
+
+	bool found = false;
+	if (map->initialized)
+		read_lock(map);
+	eval_bucket_t *bucket = find_bucket(map, board, tag);
+	for (uint8_t i = 0; i < EVAL_BUCKET_SIZE; ++i) {
+		const board_eval_t *entry = &bucket->entries[i];
+		if (entry->generation == map->generation && same_board(entry, board, tag)) {
+			*eval = *entry;
+			found = true;
+			break;
+		}
+	}
+	if (map->initialized)
+		pthread_rwlock_unlock(&map->lock);
+
+	return found;
+}
+
+bool store_eval(eval_map_t *map, board_t board, uint8_t tag, double *value, uint8_t depth, uint8_t bound, uint8_t best_move) {
+	if (map->buckets == NULL)
+		return false;
+
+	if (map->initialized)
+		write_lock(map);
+
+	eval_bucket_t *bucket = find_bucket(map, board, tag);
+	board_eval_t *entry = NULL;
+	for (uint8_t i = 0; i < EVAL_BUCKET_SIZE; ++i) {
+		board_eval_t *candidate = &bucket->entries[i];
+		if (candidate->generation == map->generation && same_board(candidate, board, tag)) {
+			entry = candidate;
+			break;
+		}
+	}
+
+	bool stored = true;
+	if (entry != NULL) {
+		// A bound of the same depth replaces a bound, it comes from a more
+		// recent window
+		bool keep = entry->depth > depth || (entry->depth == depth && entry->bound == BOUND_EXACT && bound != BOUND_EXACT);
+		if (keep) {
+			if (entry->bound == BOUND_EXACT)
+				*value = entry->value;
+			stored = false;
+		}
+	} else {
+		// A board of an earlier generation makes room, or else the one that
+		// is least worth keeping
+		entry = &bucket->entries[0];
+		for (uint8_t i = 1; i < EVAL_BUCKET_SIZE; ++i) {
+			board_eval_t *candidate = &bucket->entries[i];
+			if (entry->generation == map->generation
+					&& (candidate->generation != map->generation || replace_priority(map, candidate) < replace_priority(map, entry)))
+				entry = candidate;
+		}
+
+		if (entry->generation != map->generation)
+			map->count++;
+		entry->board = board;
+		entry->tag = tag;
+		entry->generation = map->generation;
+	}
+
+	if (stored) {
+		entry->value = *value;
+		entry->depth = depth;
+		entry->best_move = best_move;
+		entry->bound = bound;
+	}
+
+	// Kept or replaced, the board is of use to the current search
+	entry->age = map->age;
+
+	if (map->initialized)
+		pthread_rwlock_unlock(&map->lock);
+	return stored;
+}
+
+/**
+ * Maps the buckets, aligned to a huge page. Anonymous memory is zero, so
+ * every board has generation 0, and the map starts at generation 1.
+ */
+static void allocate_buckets(eval_map_t *map) {
+	size_t size_mb = map->size_mb > 0 ? map->size_mb : DEFAULT_HASH_MB;
+	uint64_t nr_buckets = 1;
+	while (nr_buckets * 2 * sizeof(eval_bucket_t) <= size_mb * (1 << 20))
+		nr_buckets *= 2;
+
+	size_t size = nr_buckets * sizeof(eval_bucket_t);
+	size_t mapped = size + HUGE_PAGE_SIZE;
+	char *start = (char *) mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (start == MAP_FAILED) {
+		fprintf(stderr, "Could not allocate a table of %zu MB\n", size >> 20);
+		return;
+	}
+
+	// Unmap what lies outside the aligned buckets
+	char *aligned = (char *) (((uintptr_t) start + HUGE_PAGE_SIZE - 1) & ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+	if (aligned > start)
+		munmap(start, aligned - start);
+	if (start + mapped > aligned + size)
+		munmap(aligned + size, start + mapped - (aligned + size));
+
+	map->huge_pages = false;
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	if (use_huge_pages)
+		map->huge_pages = madvise(aligned, size, MADV_HUGEPAGE) == 0;
 	else
-		total_hits++;
+		madvise(aligned, size, MADV_NOHUGEPAGE);
 #endif
 
-	return eval;
+	map->buckets = (eval_bucket_t *) aligned;
+	map->mask = nr_buckets - 1;
+	map->allocated = size;
+	map->generation = 1;
+	map->count = 0;
 }
 
-void delete_eval(board_eval_t *eval) {
-#ifdef PARALLEL
-	pthread_rwlock_wrlock(&maplock);
-#endif
-	HASH_DEL(eval_hashmap, eval);
-#ifdef PARALLEL
-	pthread_rwlock_unlock(&maplock);
-#endif
+static void free_buckets(eval_map_t *map) {
+	if (map->buckets != NULL)
+		munmap(map->buckets, map->allocated);
+	map->buckets = NULL;
+	map->mask = 0;
+	map->allocated = 0;
+	map->count = 0;
 }
 
-void init_map(void) {
-#ifdef PARALLEL
-	pthread_rwlock_init(&maplock, NULL);
-#endif
+void init_map(eval_map_t *map) {
+	// The map may be kept between searches
+	if (map->buckets == NULL)
+		allocate_buckets(map);
+	if (needs_lock(map) && !map->initialized) {
+		pthread_rwlock_init(&map->lock, NULL);
+		map->initialized = true;
+	}
+}
+
+void clear_map(eval_map_t *map) {
+	if (map->buckets == NULL)
+		return;
+
+	// Only once every 255 clears are the boards really cleared
+	map->count = 0;
+	if (++map->generation == 0) {
+		memset(map->buckets, 0, map->allocated);
+		map->generation = 1;
+	}
+}
+
+void age_map(eval_map_t *map) {
+	// Searches that share the map start at any time
+	if (map->initialized)
+		write_lock(map);
+	map->age++;
+	if (map->initialized)
+		pthread_rwlock_unlock(&map->lock);
 }
 
-void free_map(void) {
-	board_eval_t *cur, *tmp;
+void free_map(eval_map_t *map) {
+	free_buckets(map);
 
-	HASH_ITER(hh, eval_hashmap, cur, tmp) {
-		HASH_DEL(eval_hashmap, cur);
-		free(cur);
+	if (map->initialized) {
+		pthread_rwlock_destroy(&map->lock);
+		map->initialized = false;
 	}
+}
 
-#ifdef PARALLEL
-	pthread_rwlock_destroy(&maplock);
-#endif
+void set_map_size(eval_map_t *map, size_t size_mb) {
+	free_buckets(map);
+	map->size_mb = size_mb;
+}
+
+void set_huge_pages(bool enabled) {
+	use_huge_pages = enabled;
+}
+
+uint64_t map_count(eval_map_t *map) {
+	if (map->initialized)
+		read_lock(map);
+	uint64_t count = map->count;
+	if (map->initialized)
+		pthread_rwlock_unlock(&map->lock);
+	return count;
 }
 
-void print_hash_metrics(void) {
+#ifdef METRICS
+/**
+ * The part of the buckets that the kernel backs with huge pages, from the
+ * mappings of the process in /proc/self/smaps
+ */
+static size_t huge_page_bytes(const eval_map_t *map) {
+	FILE *smaps = fopen("/proc/self/smaps", "r");
+	if (smaps == NULL)
+		return 0;
+
+	uintptr_t address = (uintptr_t) map->buckets;
+	bool in_buckets = false;
+	size_t bytes = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), smaps) != NULL) {
+		uintptr_t start, end;
+		size_t kb;
+		if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2)
+			in_buckets = start < address + map->allocated && address < end;
+		else if (in_buckets && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+			bytes += kb << 10;
+	}
+	fclose(smaps);
+	return bytes;
+}
+#endif
+
+void print_hash_metrics(const eval_map_t *map) {
 #ifdef METRICS
 	printf("HASHMAP:\n");
-	printf("    Total Hits: %" PRIu64 "\n", total_hits);
-	printf("    Total Misses: %" PRIu64 "\n", total_misses);
-	printf("    %% Hit: %f\n", 100.0 * ((double) total_hits) / ((double) total_hits + (double) total_misses));
+	printf("    Size: %zu MB, %" PRIu64 " boards\n", map->allocated >> 20, (map->mask + 1) * EVAL_BUCKET_SIZE);
+	printf("    Filled: %" PRIu64 " boards (%.1f%%)\n", map->count, 100.0 * map->count / ((map->mask + 1) * EVAL_BUCKET_SIZE));
+	printf("    Huge pages: %s, %zu MB backed\n", map->huge_pages ? "asked for" : "not asked for", map->buckets != NULL ? huge_page_bytes(map) >> 20 : 0);
+	printf("    Lock waits: %" PRIu64 "\n", map->contended);
+	printf("    Lock wait time: %f ms\n", map->wait_ns / 1.0e6);
+#else
+	(void) map;
 #endif
 }
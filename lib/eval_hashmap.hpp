@@ -1,24 +1,145 @@
 #ifndef EVAL_HASHMAP_H
 #define EVAL_HASHMAP_H
 
-#include <uthash.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #include "state_t.hpp"
 
+// The size of a table that was not given one
+#define DEFAULT_HASH_MB 64
+
+// Boards per bucket, a bucket fills a cache line
+#define EVAL_BUCKET_SIZE 2
+
+// Boards with different tags go to different buckets
+#define EVAL_TAG_SALT 0x9E3779B97F4A7C15ULL
+
+/**
+ * What a stored value says about the board. A search that failed low only
+ * knows that the board is worth at most its value, one that failed high that
+ * it is worth at least its value.
+ */
+typedef enum {
+	BOUND_EXACT,
+	BOUND_LOWER,
+	BOUND_UPPER
+} bound_t;
+
 typedef struct {
 	board_t board;
 	double value;
 	uint8_t depth;
 	uint8_t best_move;
-	UT_hash_handle hh;
+	uint8_t bound;            // A bound_t
+	uint8_t generation;       // Of the map when it was stored, 0 if never
+	uint8_t age;              // Of the map when it was stored
+	uint8_t tag;              // Given by the search that stored it
 } board_eval_t;
 
-void add_eval(board_eval_t *eval);
-board_eval_t *find_eval(board_t board);
-void delete_eval(board_eval_t *eval);
-void init_map(void);
-void free_map(void);
+typedef struct alignas(64) {
+	board_eval_t entries[EVAL_BUCKET_SIZE];
+} eval_bucket_t;
+
+/**
+ * A transposition table of a fixed size. Every search owns one, so searches
+ * do not see each other's boards, unless a map is shared on purpose. A map
+ * has to be zero initialised before its first use. In the parallel build the
+ * threads of one search share the map behind a lock, shared maps take the
+ * lock in any build.
+ *
+ * The buckets are allocated once, by the first init_map, aligned to a huge
+ * page, and the kernel is asked to back them with transparent huge pages
+ * (see set_huge_pages), so the random accesses of the search miss the TLB
+ * less often. A board goes in the bucket of its hash, where it replaces a
+ * board from before the last clear_map, or else the board that is shallowest
+ * after a penalty for the searches it is old (see age_map).
+ *
+ * Every board is stored with a tag, and only found with the same tag.
+ * Searches that share a map, but whose values do not compare, such as those
+ * of different evaluation functions, tag their boards differently.
+ */
+typedef struct {
+	eval_bucket_t *buckets;
+	uint64_t mask;            // The number of buckets, less one
+	size_t size_mb;           // 0 for DEFAULT_HASH_MB
+	size_t allocated;         // Bytes
+	bool huge_pages;          // Huge pages were asked for
+	uint8_t generation;       // Boards of other generations are gone
+	uint8_t age;              // Boards of other ages are kept, but replaced first
+	uint64_t count;           // Boards of this generation
+	pthread_rwlock_t lock;
+	bool initialized;
+	bool shared;              // Used by several searches at once
+	uint64_t contended;       // Lock waits, only counted with METRICS
+	uint64_t wait_ns;         // Time spent in those waits
+} eval_map_t;
+
+/**
+ * Copies the board from the map
+ *
+ * @return False if the map does not have the board
+ */
+bool find_eval(eval_map_t *map, board_t board, uint8_t tag, board_eval_t *eval);
+
+/**
+ * Stores the board, unless the map already has it deeper, or as deep with an
+ * exact value where the value to store is only a bound
+ *
+ * @param[in,out] The value to store, the value of the map if that is exact and at least as deep
+ * @param bound - a bound_t
+ * @return Whether the board was stored
+ */
+bool store_eval(eval_map_t *map, board_t board, uint8_t tag, double *value, uint8_t depth, uint8_t bound, uint8_t best_move);
+
+/**
+ * Starts loading the bucket of the board into the cache
+ */
+static inline void prefetch_eval(const eval_map_t *map, board_t board, uint8_t tag) {
+	if (map->buckets != NULL)
+		__builtin_prefetch(&map->buckets[(hash_board(board) + tag * EVAL_TAG_SALT) & map->mask]);
+}
+
+/**
+ * Allocates the buckets, unless the map has them, and sets up the lock
+ */
+void init_map(eval_map_t *map);
+void free_map(eval_map_t *map);
+
+/**
+ * Forgets the boards, but keeps the map ready for use. The caller makes sure
+ * no search uses the map.
+ */
+void clear_map(eval_map_t *map);
+
+/**
+ * Starts a new search in the map. Its boards are still found, but the boards
+ * of older searches are replaced before those of the new one. A map that is
+ * never cleared, such as one that is shared, would otherwise keep the deep
+ * boards of searches long gone.
+ */
+void age_map(eval_map_t *map);
+
+/**
+ * Sets the size of the buckets, which is rounded down to a power of two. The
+ * buckets are freed, and allocated at the new size by the next init_map.
+ */
+void set_map_size(eval_map_t *map, size_t size_mb);
+
+/**
+ * Whether maps that are allocated from now on ask for transparent huge pages.
+ * Without, they ask for none, so the pages are small even if the kernel backs
+ * all memory with huge pages.
+ */
+void set_huge_pages(bool enabled);
+
+/**
+ * The number of boards in the map
+ */
+uint64_t map_count(eval_map_t *map);
 
-void print_hash_metrics(void);
+void print_hash_metrics(const eval_map_t *map);
 
 #endif
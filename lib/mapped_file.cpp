@@ -0,0 +1,37 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool map_file(const char *path, mapped_file_t *file) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	file->data = data;
+	file->size = st.st_size;
+	return true;
+}
+
+void unmap_file(mapped_file_t *file) {
+	if (file->data != NULL)
+		munmap((void *) file->data, file->size);
+	file->data = NULL;
+	file->size = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A read-only view of a file that is mapped into memory. Pages are only read
+ * from disk when they are first touched, so mapping even a large file is
+ * close to free.
+ */
+typedef struct {
+	const void *data;
+	size_t size;
+} mapped_file_t;
+
+/**
+ * Maps the file at the given path into memory
+ *
+ * @param[in] Path of the file
+ * @param[out] The mapping, only valid when true is returned
+ * @return Whether the file could be mapped
+ */
+bool map_file(const char *path, mapped_file_t *file);
+
+/**
+ * Releases a mapping made with map_file. Does nothing for an empty mapping.
+ */
+void unmap_file(mapped_file_t *file);
+
+#endif
@@ -0,0 +1,274 @@
+#include "perf_counters.hpp"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The cheapest of this many pairs of reads is taken as the cost of a read
+#define CALIBRATION_READS 64
+
+typedef struct {
+	uint32_t type;
+	uint64_t config;
+} event_config_t;
+
+static const event_config_t configs[PERF_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static const char *names[PERF_EVENTS] = {
+	"cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses", "branch misses"
+};
+
+// What the first thread that opened its counters found
+static std::mutex probe_lock;
+static bool probed = false;
+static bool available[PERF_EVENTS];
+static int open_error = 0;
+
+/**
+ * The counters of one thread. The first counter that opens leads the group,
+ * a counter that does not fit in the group is left out and the others stay.
+ */
+class thread_counters_t {
+public:
+	int fds[PERF_EVENTS];
+	struct perf_event_mmap_page *pages[PERF_EVENTS];
+	int leader;
+	bool opened;
+	bool any;
+	perf_counts_t overhead;
+
+	thread_counters_t() : leader(-1), opened(false), any(false), overhead() {
+		for (int event = 0; event < PERF_EVENTS; ++event) {
+			fds[event] = -1;
+			pages[event] = NULL;
+		}
+	}
+
+	~thread_counters_t() {
+		long page_size = sysconf(_SC_PAGESIZE);
+		for (int event = 0; event < PERF_EVENTS; ++event) {
+			if (pages[event] != NULL)
+				munmap(pages[event], page_size);
+			if (fds[event] >= 0)
+				close(fds[event]);
+		}
+	}
+};
+
+static thread_local thread_counters_t counters;
+
+static inline void barrier(void) {
+	asm volatile("" ::: "memory");
+}
+
+static uint64_t read_counter(int event) {
+	int fd = counters.fds[event];
+	if (fd < 0)
+		return 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+	// Read the counter from user space, as long as the kernel does not
+	// change it under our hands, see perf_event_open(2)
+	struct perf_event_mmap_page *page = counters.pages[event];
+	if (page != NULL) {
+		uint32_t sequence;
+		uint64_t count;
+		bool read_pmc;
+		do {
+			sequence = page->lock;
+			barrier();
+			uint32_t index = page->index;
+			count = page->offset;
+			read_pmc = page->cap_user_rdpmc && index != 0;
+			if (read_pmc) {
+				uint16_t width = page->pmc_width;
+				int64_t pmc = __builtin_ia32_rdpmc(index - 1);
+				pmc <<= 64 - width;
+				pmc >>= 64 - width;
+				count += pmc;
+			}
+			barrier();
+		} while (page->lock != sequence);
+
+		if (read_pmc)
+			return count;
+	}
+#endif
+
+	// The count, the time enabled and the time running
+	uint64_t values[3];
+	if (read(fd, values, sizeof(values)) != sizeof(values))
+		return 0;
+	return values[0];
+}
+
+/**
+ * How long the group was enabled and how long it counted, from the page of
+ * its leader where the kernel allows it, see perf_event_open(2)
+ */
+static void read_times(uint64_t *enabled, uint64_t *running) {
+	*enabled = 0;
+	*running = 0;
+	if (counters.leader < 0)
+		return;
+
+#if defined(__x86_64__) || defined(__i386__)
+	struct perf_event_mmap_page *page = counters.pages[counters.leader];
+	if (page != NULL && page->cap_user_time) {
+		uint32_t sequence;
+		uint32_t index;
+		uint64_t cycles;
+		uint64_t time_offset;
+		uint32_t time_mult;
+		uint16_t time_shift;
+		do {
+			sequence = page->lock;
+			barrier();
+			*enabled = page->time_enabled;
+			*running = page->time_running;
+			index = page->index;
+			cycles = __builtin_ia32_rdtsc();
+			time_offset = page->time_offset;
+			time_mult = page->time_mult;
+			time_shift = page->time_shift;
+			barrier();
+		} while (page->lock != sequence);
+
+		// The times are of when the group was last scheduled, so the time
+		// since is added, to the time running only if it is still counting
+		uint64_t quotient = cycles >> time_shift;
+		uint64_t remainder = cycles & (((uint64_t) 1 << time_shift) - 1);
+		uint64_t delta = time_offset + quotient * time_mult + ((remainder * time_mult) >> time_shift);
+		*enabled += delta;
+		if (index != 0)
+			*running += delta;
+		return;
+	}
+#endif
+
+	uint64_t values[3];
+	if (read(counters.fds[counters.leader], values, sizeof(values)) != sizeof(values))
+		return;
+	*enabled = values[1];
+	*running = values[2];
+}
+
+static void calibrate(void) {
+	perf_snapshot_t first, second;
+	for (int event = 0; event < PERF_EVENTS; ++event)
+		counters.overhead.values[event] = UINT64_MAX;
+
+	for (int i = 0; i < CALIBRATION_READS; ++i) {
+		perf_read(&first);
+		perf_read(&second);
+		for (int event = 0; event < PERF_EVENTS; ++event) {
+			uint64_t cost = second.counts.values[event] - first.counts.values[event];
+			if (cost < counters.overhead.values[event])
+				counters.overhead.values[event] = cost;
+		}
+	}
+}
+
+bool perf_open_thread(void) {
+	if (counters.opened)
+		return counters.any;
+	counters.opened = true;
+
+	int first_error = 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	for (int event = 0; event < PERF_EVENTS; ++event) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = configs[event].type;
+		attr.config = configs[event].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		int group = counters.leader >= 0 ? counters.fds[counters.leader] : -1;
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+		if (fd < 0) {
+			if (first_error == 0)
+				first_error = errno;
+			continue;
+		}
+		counters.fds[event] = fd;
+		counters.any = true;
+		if (counters.leader < 0)
+			counters.leader = event;
+
+		void *page = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+		counters.pages[event] = page != MAP_FAILED ? (struct perf_event_mmap_page *) page : NULL;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(probe_lock);
+		if (!probed) {
+			probed = true;
+			for (int event = 0; event < PERF_EVENTS; ++event)
+				available[event] = counters.fds[event] >= 0;
+			open_error = counters.any ? 0 : first_error;
+		}
+	}
+
+	if (counters.any)
+		calibrate();
+	return counters.any;
+}
+
+bool perf_available(perf_event_t event) {
+	std::lock_guard<std::mutex> lock(probe_lock);
+	return probed && available[event];
+}
+
+const char *perf_error(void) {
+	std::lock_guard<std::mutex> lock(probe_lock);
+	if (!probed)
+		return "never opened";
+	return open_error != 0 ? strerror(open_error) : NULL;
+}
+
+const char *perf_event_name(perf_event_t event) {
+	return names[event];
+}
+
+void perf_read(perf_snapshot_t *snapshot) {
+	for (int event = 0; event < PERF_EVENTS; ++event)
+		snapshot->counts.values[event] = read_counter(event);
+	read_times(&snapshot->time_enabled, &snapshot->time_running);
+}
+
+void perf_add_since(const perf_snapshot_t *start, perf_counts_t *total) {
+	perf_snapshot_t now;
+	perf_read(&now);
+	uint64_t enabled = now.time_enabled - start->time_enabled;
+	uint64_t running = now.time_running - start->time_running;
+
+	for (int event = 0; event < PERF_EVENTS; ++event) {
+		uint64_t counted = now.counts.values[event] - start->counts.values[event];
+		uint64_t overhead = counters.overhead.values[event];
+		counted = counted > overhead ? counted - overhead : 0;
+
+		// The group only counted part of the time it was enabled
+		if (running > 0 && running < enabled)
+			counted = (uint64_t) ((double) counted * enabled / running);
+		total->values[event] += counted;
+	}
+}
+
+void perf_add(perf_counts_t *total, const perf_counts_t *counts) {
+	for (int event = 0; event < PERF_EVENTS; ++event)
+		total->values[event] += counts->values[event];
+}
@@ -0,0 +1,80 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/**
+ * Hardware performance counters of the calling thread, from perf_event_open.
+ * Only user space is counted. Counters that the processor, the kernel or the
+ * permissions (see /proc/sys/kernel/perf_event_paranoid) do not allow are
+ * left out, and read as 0. Without any counters, as in most virtual machines
+ * and containers, everything reads as 0.
+ *
+ * The counters are opened as one group, so they always count at the same
+ * time, and ratios such as instructions per cycle are of the same window.
+ * When the kernel has to share the hardware counters with other groups, what
+ * was counted is scaled up to the time the group was enabled.
+ */
+
+typedef enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,          // Level 1 data cache read misses
+	PERF_LLC_MISSES,          // Last level cache misses
+	PERF_DTLB_MISSES,         // Data TLB read misses
+	PERF_BRANCH_MISSES,
+	PERF_EVENTS
+} perf_event_t;
+
+typedef struct {
+	uint64_t values[PERF_EVENTS];
+} perf_counts_t;
+
+/**
+ * The counters at one point in time, with how long the group was enabled and
+ * how long it actually counted until then, in nanoseconds
+ */
+typedef struct {
+	perf_counts_t counts;
+	uint64_t time_enabled;
+	uint64_t time_running;
+} perf_snapshot_t;
+
+/**
+ * Opens the counters of the calling thread, unless it already did. The
+ * counters are closed when the thread exits.
+ *
+ * @return Whether any counter could be opened
+ */
+bool perf_open_thread(void);
+
+/**
+ * Whether the counter could be opened in the group, on the first thread
+ * that tried
+ */
+bool perf_available(perf_event_t event);
+
+/**
+ * Why no counter could be opened, NULL if any could
+ */
+const char *perf_error(void);
+
+const char *perf_event_name(perf_event_t event);
+
+/**
+ * Reads the counters of the calling thread. With rdpmc, where the kernel
+ * allows it, a read takes tens of cycles, otherwise it is a system call.
+ */
+void perf_read(perf_snapshot_t *snapshot);
+
+/**
+ * Adds what was counted since start to total, less what it costs to read
+ * the counters, as measured when they were opened, and scaled to the time
+ * the group was enabled
+ */
+void perf_add_since(const perf_snapshot_t *start, perf_counts_t *total);
+
+void perf_add(perf_counts_t *total, const perf_counts_t *counts);
+
+#endif
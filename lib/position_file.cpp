@@ -0,0 +1,67 @@
+#include "position_file.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(position_header_t) == 16, "The header is stored as it is in memory");
+static_assert(sizeof(position_record_t) == 24, "Records are stored as they are in memory");
+
+static bool write_all(int fd, const void *buffer, size_t size) {
+	const char *p = (const char *) buffer;
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+bool append_positions(const char *path, const position_record_t *records, size_t nr_records) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return false;
+
+	flock(fd, LOCK_EX);
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok && st.st_size == 0) {
+		position_header_t header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, POSITION_MAGIC, sizeof(header.magic));
+		header.version = POSITION_VERSION;
+		ok = write_all(fd, &header, sizeof(header));
+	} else if (ok && (st.st_size - sizeof(position_header_t)) % sizeof(position_record_t) != 0) {
+		// A record torn by a crash would shift everything after it
+		off_t tail = (st.st_size - sizeof(position_header_t)) % sizeof(position_record_t);
+		ok = ftruncate(fd, st.st_size - tail) == 0;
+	}
+
+	ok = ok && write_all(fd, records, nr_records * sizeof(position_record_t));
+	flock(fd, LOCK_UN);
+
+	return close(fd) == 0 && ok;
+}
+
+const position_record_t *map_positions(const char *path, mapped_file_t *file, size_t *nr_records) {
+	if (!map_file(path, file))
+		return NULL;
+
+	const position_header_t *header = (const position_header_t *) file->data;
+	if (file->size < sizeof(*header)
+			|| strncmp(header->magic, POSITION_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != POSITION_VERSION) {
+		fprintf(stderr, "ERROR: %s is not a valid position file\n", path);
+		unmap_file(file);
+		return NULL;
+	}
+
+	// A record that is still being appended is left out
+	*nr_records = (file->size - sizeof(*header)) / sizeof(position_record_t);
+	return (const position_record_t *) (header + 1);
+}
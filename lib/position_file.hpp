@@ -0,0 +1,60 @@
+#ifndef POSITION_FILE_H
+#define POSITION_FILE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mapped_file.hpp"
+
+/**
+ * A compact binary file of positions from games, for tuning and testing. The
+ * file is a header followed by fixed size records, without a count, so new
+ * positions are simply appended to the end and the number of positions
+ * follows from the size of the file.
+ */
+
+#define POSITION_MAGIC "OOOOPOS"
+#define POSITION_VERSION 1
+
+// The score of a position that was not searched
+#define POSITION_NO_SCORE INT32_MIN
+
+// The move of the last position of a game
+#define POSITION_NO_MOVE 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+} position_header_t;
+
+typedef struct {
+	uint64_t player;     // The player is to move
+	uint64_t opponent;
+	int32_t score;       // Search score for the player to move, or POSITION_NO_SCORE
+	int8_t result;       // Final disc difference for the player to move
+	uint8_t move;        // The move that was played, or POSITION_NO_MOVE
+	uint8_t reserved[2];
+} position_record_t;
+
+/**
+ * Appends the records to the file at the given path, and writes the header
+ * first if the file is new. Appends are serialized with a lock on the file,
+ * so several processes may append to the same file.
+ *
+ * @return Whether all records were written
+ */
+bool append_positions(const char *path, const position_record_t *records, size_t nr_records);
+
+/**
+ * Maps the file at the given path
+ *
+ * @param[in] Path of the file
+ * @param[out] The mapping, to release with unmap_file
+ * @param[out] The number of records
+ * @return The records, or NULL if the file is not a valid position file
+ */
+const position_record_t *map_positions(const char *path, mapped_file_t *file, size_t *nr_records);
+
+#endif
@@ -12,6 +12,9 @@ void from_coordinate(uint8_t c, char *column, char *row) {
 	*row = numbers[c / 8];
 }
 
+uint8_t to_coordinate(char column, char row) {
+	return (7 - (column - 'a')) + (7 - (row - '1')) * 8;
+}
 
 bool is_set(uint64_t number, uint8_t n) {
 	return (number & ONE << n) != 0;
@@ -146,6 +149,37 @@ uint64_t get_valid_moves(board_t board) {
 	return legal_moves;
 }
 
+void get_both_valid_moves(board_t board, uint64_t *player_moves, uint64_t *opponent_moves) {
+	uint64_t p_board, o_board;
+	uint64_t empty_cells = ~(board.player | board.opponent);
+	uint64_t player_legal = 0;
+	uint64_t opponent_legal = 0;
+
+	// Same as get_valid_moves, but the two independent chains give the CPU
+	// something to do while waiting on the other
+	for (uint8_t d = 0; d <= 7; d++) {
+		p_board = shift(board.player, d) & board.opponent;
+		o_board = shift(board.opponent, d) & board.player;
+
+		p_board |= shift(p_board, d) & board.opponent;
+		o_board |= shift(o_board, d) & board.player;
+		p_board |= shift(p_board, d) & board.opponent;
+		o_board |= shift(o_board, d) & board.player;
+		p_board |= shift(p_board, d) & board.opponent;
+		o_board |= shift(o_board, d) & board.player;
+		p_board |= shift(p_board, d) & board.opponent;
+		o_board |= shift(o_board, d) & board.player;
+		p_board |= shift(p_board, d) & board.opponent;
+		o_board |= shift(o_board, d) & board.player;
+
+		player_legal |= shift(p_board, d) & empty_cells;
+		opponent_legal |= shift(o_board, d) & empty_cells;
+	}
+
+	*player_moves = player_legal;
+	*opponent_moves = opponent_legal;
+}
+
 bool has_valid_move(board_t board) {
 	return get_valid_moves(board) > 0;
 }
@@ -160,6 +194,86 @@ void switch_boards(board_t *board) {
 	board->opponent = temp;
 }
 
+uint64_t hash_board(board_t board) {
+	// Multiply each half with an odd constant, then finalize the way
+	// splitmix64 does so every bit of the board affects every bit of the hash
+	uint64_t h = board.player * 0x9E3779B97F4A7C15ULL ^ board.opponent * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 30;
+	h *= 0xBF58476D1CE4E5B9ULL;
+	h ^= h >> 27;
+	h *= 0x94D049BB133111EBULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t flip_vertical(uint64_t number) {
+	return __builtin_bswap64(number);
+}
+
+static uint64_t mirror_horizontal(uint64_t number) {
+	const uint64_t k1 = 0x5555555555555555ULL;
+	const uint64_t k2 = 0x3333333333333333ULL;
+	const uint64_t k4 = 0x0F0F0F0F0F0F0F0FULL;
+	number = ((number >> 1) & k1) | ((number & k1) << 1);
+	number = ((number >> 2) & k2) | ((number & k2) << 2);
+	number = ((number >> 4) & k4) | ((number & k4) << 4);
+	return number;
+}
+
+/**
+ * Based on https://www.chessprogramming.org/Flipping_Mirroring_and_Rotating
+ */
+static uint64_t flip_diagonal(uint64_t number) {
+	const uint64_t k1 = 0x5500550055005500ULL;
+	const uint64_t k2 = 0x3333000033330000ULL;
+	const uint64_t k4 = 0x0F0F0F0F00000000ULL;
+	uint64_t t;
+	t = k4 & (number ^ (number << 28));
+	number ^= t ^ (t >> 28);
+	t = k2 & (number ^ (number << 14));
+	number ^= t ^ (t >> 14);
+	t = k1 & (number ^ (number << 7));
+	number ^= t ^ (t >> 7);
+	return number;
+}
+
+uint64_t transform(uint64_t number, uint8_t symmetry) {
+	if (symmetry & 1)
+		number = flip_vertical(number);
+	if (symmetry & 2)
+		number = mirror_horizontal(number);
+	if (symmetry & 4)
+		number = flip_diagonal(number);
+	return number;
+}
+
+board_t transform_board(board_t board, uint8_t symmetry) {
+	board.player = transform(board.player, symmetry);
+	board.opponent = transform(board.opponent, symmetry);
+	return board;
+}
+
+uint8_t transform_square(uint8_t coordinate, uint8_t symmetry) {
+	return __builtin_ctzll(transform(ONE << coordinate, symmetry));
+}
+
+board_t canonical_board(board_t board, uint8_t *symmetry) {
+	board_t best = board;
+	uint8_t best_symmetry = 0;
+
+	for (uint8_t i = 1; i < SYMMETRIES; ++i) {
+		board_t transformed = transform_board(board, i);
+		if (transformed.player < best.player || (transformed.player == best.player && transformed.opponent < best.opponent)) {
+			best = transformed;
+			best_symmetry = i;
+		}
+	}
+
+	if (symmetry != NULL)
+		*symmetry = best_symmetry;
+	return best;
+}
+
 void print_state(board_t board, uint64_t valid_moves, bool show_valid_moves) {
 	// Duplicate horizontal bars because our pieces are double-width
 	for (int8_t y = 63; y >= 0; y -= 8) {
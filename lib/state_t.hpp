@@ -40,6 +40,15 @@ typedef struct {
  */
 void from_coordinate(uint8_t c, char *column, char *row);
 
+/**
+ * Converts a human readable coordinate to the internal representation
+ *
+ * @param[in] Column, 'a' through 'h'
+ * @param[in] Row, '1' through '8'
+ * @return Coordinate in internal representation
+ */
+uint8_t to_coordinate(char column, char row);
+
 /**
  * Checks if the specified bit is set.
  *
@@ -89,6 +98,16 @@ void do_move(board_t *board, uint8_t coordinate);
  */
 uint64_t get_valid_moves(board_t board);
 
+/**
+ * Generate all valid moves for both the player and the opponent in a single
+ * pass. Equivalent to calling get_valid_moves before and after switch_boards.
+ *
+ * @param[in] The board
+ * @param[out] The valid moves of the player
+ * @param[out] The valid moves of the opponent
+ */
+void get_both_valid_moves(board_t board, uint64_t *player_moves, uint64_t *opponent_moves);
+
 /**
  * Check if the move is a valid move. NOTE: Does not perform a lookup in the
  * table, but calculates the value itself. Should be used to update the table.
@@ -101,6 +120,38 @@ bool has_valid_move(board_t board);
 
 void switch_boards(board_t *board);
 
+/**
+ * A well mixed 64-bit hash of the board, for tables indexed by position
+ */
+uint64_t hash_board(board_t board);
+
+/**
+ * Number of symmetries of the board (the dihedral group of the square)
+ */
+#define SYMMETRIES 8
+
+/**
+ * Applies one of the eight symmetries of the board. Bit 0 of the symmetry
+ * flips the board vertically, bit 1 mirrors it horizontally and bit 2 then
+ * flips it along the diagonal. Symmetry 0 is the identity.
+ *
+ * @param[in] The bitboard to transform
+ * @param[in] The symmetry, 0 through 7
+ */
+uint64_t transform(uint64_t number, uint8_t symmetry);
+board_t transform_board(board_t board, uint8_t symmetry);
+uint8_t transform_square(uint8_t coordinate, uint8_t symmetry);
+
+/**
+ * The smallest of the eight transformations of the board, comparing the
+ * player first. Boards that are the same up to symmetry have the same
+ * canonical board, so it can be used to store positions only once.
+ *
+ * @param[in] The board
+ * @param[out] The symmetry that transforms the board into the canonical board, may be NULL
+ */
+board_t canonical_board(board_t board, uint8_t *symmetry);
+
 /**
  * Print a graphical representation of the entire field
  *
@@ -0,0 +1,66 @@
+#include "trace.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static_assert(sizeof(trace_header_t) == 48, "The header is stored as it is in memory");
+static_assert(sizeof(trace_record_t) == 32, "Records are stored as they are in memory");
+static_assert((TRACE_RECORDS & (TRACE_RECORDS - 1)) == 0, "The ring buffer is indexed with a mask");
+
+uint64_t trace_time_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void init_trace_buffer(trace_buffer_t *buffer) {
+	buffer->records = (trace_record_t *) malloc(TRACE_RECORDS * sizeof(trace_record_t));
+	buffer->written = 0;
+}
+
+void free_trace_buffer(trace_buffer_t *buffer) {
+	free(buffer->records);
+	buffer->records = NULL;
+	buffer->written = 0;
+}
+
+bool write_trace(FILE *file, uint64_t player, uint64_t opponent, const trace_buffer_t *buffers, size_t nr_buffers) {
+	trace_header_t header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.threads = nr_buffers;
+	header.player = player;
+	header.opponent = opponent;
+	for (size_t i = 0; i < nr_buffers; ++i) {
+		uint64_t written = buffers[i].written;
+		header.records += written < TRACE_RECORDS ? written : TRACE_RECORDS;
+		header.dropped += written < TRACE_RECORDS ? 0 : written - TRACE_RECORDS;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		return false;
+
+	for (size_t i = 0; i < nr_buffers; ++i) {
+		const trace_buffer_t *buffer = &buffers[i];
+		uint64_t first = buffer->written < TRACE_RECORDS ? 0 : buffer->written - TRACE_RECORDS;
+		for (uint64_t j = first; j < buffer->written; ++j) {
+			trace_record_t record = buffer->records[j & (TRACE_RECORDS - 1)];
+			record.thread = i;
+			if (fwrite(&record, sizeof(record), 1, file) != 1)
+				return false;
+		}
+	}
+	return fflush(file) == 0;
+}
+
+bool read_trace(FILE *file, trace_header_t *header, std::vector<trace_record_t> *records) {
+	if (fread(header, sizeof(*header), 1, file) != 1)
+		return false;
+	if (strncmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || header->version != TRACE_VERSION)
+		return false;
+
+	records->resize(header->records);
+	return fread(records->data(), sizeof(trace_record_t), header->records, file) == header->records;
+}
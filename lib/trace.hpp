@@ -0,0 +1,109 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+/**
+ * A binary trace of searches, from builds with TRACE. Every search appends a
+ * block to the file: a header, followed by the records of all its threads.
+ * The records of a thread are in the order they were written, which is the
+ * order in which the nodes were left, so children come before their parent.
+ *
+ * While a search runs, every thread writes its records into a ring buffer of
+ * its own, so the threads never wait for each other or for the disk. A thread
+ * that writes more records than its buffer holds overwrites its oldest ones,
+ * which the header counts as dropped.
+ */
+
+#define TRACE_MAGIC "OOOOTRC"
+#define TRACE_VERSION 1
+
+// Records per thread that a ring buffer holds, a power of two
+#define TRACE_RECORDS (1 << 20)
+
+typedef enum {
+	TRACE_NODE,               // A node of negamax, written when it is left
+	TRACE_ROOT_BEGIN,         // A thread starts to search a move at the root
+	TRACE_ROOT_END,
+	TRACE_ITERATION_BEGIN,    // The search starts an iteration
+	TRACE_ITERATION_END       // The iteration was completed
+} trace_kind_t;
+
+// The node was aborted before it looked in the table
+#define TRACE_NO_PROBE 255
+
+// The node did not fail high
+#define TRACE_NO_CUTOFF 255
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t threads;
+	uint64_t player;          // The board at the root, the player is to move
+	uint64_t opponent;
+	uint64_t records;         // That follow the header
+	uint64_t dropped;         // Overwritten in the ring buffers
+} trace_header_t;
+
+/**
+ * For nodes, the window and value are those negamax had, the probe is a
+ * probe_outcome_t (see ai.hpp), and the cutoff is the index in the ordered
+ * list of moves of the move that failed high. For the root and iteration
+ * records, the depth is that of the search, the cutoff of a root record is
+ * the move at the root.
+ */
+typedef struct {
+	uint64_t time_ns;         // Since the start of the search
+	uint32_t duration_ns;     // Of the node with all its children, saturated
+	float alpha;
+	float beta;
+	float value;
+	uint8_t kind;
+	uint8_t depth;            // Remaining depth
+	uint8_t ply;              // Distance to the root move
+	uint8_t probe;
+	uint8_t cutoff;
+	uint8_t moves;            // Legal moves, 0 for leaves
+	uint8_t searched;         // Moves that were searched
+	uint8_t thread;           // Set when the buffers are written
+} trace_record_t;
+
+typedef struct {
+	trace_record_t *records;
+	uint64_t written;         // Since the start of the search
+} trace_buffer_t;
+
+/**
+ * The time in nanoseconds, of a clock that does not jump
+ */
+uint64_t trace_time_ns(void);
+
+void init_trace_buffer(trace_buffer_t *buffer);
+void free_trace_buffer(trace_buffer_t *buffer);
+
+static inline void trace_write(trace_buffer_t *buffer, const trace_record_t *record) {
+	buffer->records[buffer->written++ & (TRACE_RECORDS - 1)] = *record;
+}
+
+/**
+ * Appends a block with the records of the buffers to the file, the oldest
+ * record of every buffer first
+ *
+ * @return Whether everything was written
+ */
+bool write_trace(FILE *file, uint64_t player, uint64_t opponent, const trace_buffer_t *buffers, size_t nr_buffers);
+
+/**
+ * Reads the next block of the file
+ *
+ * @param[out] The header of the block
+ * @param[out] Its records
+ * @return False at the end of the file, or if the file is not a valid trace
+ */
+bool read_trace(FILE *file, trace_header_t *header, std::vector<trace_record_t> *records);
+
+#endif
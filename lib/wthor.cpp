@@ -0,0 +1,131 @@
+#include "wthor.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+// The records are read in place, which relies on a little endian machine
+static_assert(sizeof(wthor_game_t) == WTHOR_GAME_SIZE, "Games are read as they are stored");
+
+bool open_wthor(const char *path, wthor_file_t *file) {
+	if (!map_file(path, &file->file))
+		return false;
+
+	const uint8_t *header = (const uint8_t *) file->file.data;
+	uint32_t nr_games = 0;
+	if (file->file.size >= WTHOR_HEADER_SIZE)
+		memcpy(&nr_games, header + 4, sizeof(nr_games));
+
+	// Byte 12 is the size of the board, 0 also means 8 in older files
+	if (file->file.size < WTHOR_HEADER_SIZE
+			|| (header[12] != 0 && header[12] != 8)
+			|| (file->file.size - WTHOR_HEADER_SIZE) / WTHOR_GAME_SIZE < nr_games) {
+		fprintf(stderr, "ERROR: %s is not a WTHOR game database\n", path);
+		unmap_file(&file->file);
+		return false;
+	}
+
+	file->games = (const wthor_game_t *) (header + WTHOR_HEADER_SIZE);
+	file->nr_games = nr_games;
+	memcpy(&file->year, header + 10, sizeof(file->year));
+	file->depth = header[14];
+	return true;
+}
+
+void close_wthor(wthor_file_t *file) {
+	unmap_file(&file->file);
+	file->games = NULL;
+	file->nr_games = 0;
+}
+
+wthor_status_t replay_wthor_game(const wthor_game_t *game, wthor_record_t *records, uint8_t *nr_records) {
+	board_t board = {.player = 0x0000000810000000ULL, .opponent = 0x0000001008000000ULL};
+	bool black = true;
+	uint8_t ply = 0;
+	wthor_status_t status = WTHOR_OK;
+
+	// The file has the final score from the perspective of black
+	int8_t black_result = 2 * game->black_discs - 64;
+
+	for (; ply < WTHOR_MOVES && game->moves[ply] != 0; ++ply) {
+		uint8_t row = game->moves[ply] / 10;
+		uint8_t column = game->moves[ply] % 10;
+
+		if (!has_valid_move(board)) {
+			switch_boards(&board);
+			black = !black;
+		}
+
+		uint8_t move = 64;
+		if (row >= 1 && row <= 8 && column >= 1 && column <= 8)
+			move = to_coordinate('a' + column - 1, '0' + row);
+		if (move == 64 || !is_set(get_valid_moves(board), move)) {
+			status = WTHOR_ILLEGAL_MOVE;
+			break;
+		}
+
+		if (records != NULL) {
+			records[ply].board = board;
+			records[ply].move = move;
+			records[ply].black = black;
+			records[ply].result = black ? black_result : -black_result;
+			records[ply].ply = ply;
+		}
+
+		do_move(&board, move);
+		switch_boards(&board);
+		black = !black;
+	}
+
+	if (records != NULL && status == WTHOR_OK) {
+		records[ply].board = board;
+		records[ply].move = 64;
+		records[ply].black = black;
+		records[ply].result = black ? black_result : -black_result;
+		records[ply].ply = ply;
+	}
+	if (nr_records != NULL)
+		*nr_records = status == WTHOR_OK ? ply + 1 : 0;
+	if (status != WTHOR_OK)
+		return status;
+
+	// Games that were not played out, for instance on time, can not be checked
+	board_t other = board;
+	switch_boards(&other);
+	if (has_valid_move(board) || has_valid_move(other))
+		return WTHOR_OK;
+
+	uint8_t black_discs = black ? count(board.player) : count(board.opponent);
+	uint8_t white_discs = black ? count(board.opponent) : count(board.player);
+	uint8_t empties = 64 - black_discs - white_discs;
+	if (black_discs > white_discs)
+		black_discs += empties;
+	else if (black_discs == white_discs)
+		black_discs += empties / 2;
+
+	return black_discs == game->black_discs ? WTHOR_OK : WTHOR_WRONG_SCORE;
+}
+
+void start_wthor_iterator(const wthor_file_t *file, wthor_iterator_t *iterator) {
+	iterator->file = file;
+	iterator->game = 0;
+	iterator->nr_records = 0;
+	iterator->next = 0;
+	iterator->nr_invalid = 0;
+}
+
+bool next_wthor_record(wthor_iterator_t *iterator, wthor_record_t *record) {
+	while (iterator->next == iterator->nr_records) {
+		if (iterator->game == iterator->file->nr_games)
+			return false;
+
+		iterator->next = 0;
+		const wthor_game_t *game = &iterator->file->games[iterator->game++];
+		if (replay_wthor_game(game, iterator->records, &iterator->nr_records) != WTHOR_OK) {
+			iterator->nr_records = 0;
+			iterator->nr_invalid++;
+		}
+	}
+
+	*record = iterator->records[iterator->next++];
+	return true;
+}
@@ -0,0 +1,95 @@
+#ifndef WTHOR_H
+#define WTHOR_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mapped_file.hpp"
+#include "state_t.hpp"
+
+/**
+ * Reader for WTHOR game databases (.wtb files), the format of the archives of
+ * the French Othello federation. A file is a 16 byte header followed by
+ * records of 68 bytes, one per game. The file is mapped, so games are read
+ * straight from the page cache without copying.
+ */
+
+#define WTHOR_HEADER_SIZE 16
+#define WTHOR_GAME_SIZE 68
+#define WTHOR_MOVES 60
+
+typedef struct {
+	uint16_t tournament;
+	uint16_t black;             // Player numbers, see the .jou file
+	uint16_t white;
+	uint8_t black_discs;        // Final number of black discs, empty squares go to the winner
+	uint8_t theoretical_discs;  // Black discs with perfect play from the depth in the header
+	uint8_t moves[WTHOR_MOVES]; // 10 * row + column, both from 1, 0 after the last move
+} wthor_game_t;
+
+typedef struct {
+	mapped_file_t file;
+	const wthor_game_t *games;
+	uint32_t nr_games;
+	uint16_t year;
+	uint8_t depth;              // Depth from which the theoretical score is exact
+} wthor_file_t;
+
+typedef enum {
+	WTHOR_OK, WTHOR_ILLEGAL_MOVE, WTHOR_WRONG_SCORE
+} wthor_status_t;
+
+/**
+ * One position of a game, with the move that was played in it
+ */
+typedef struct {
+	board_t board;              // The player is to move
+	uint8_t move;               // Internal coordinate, 64 at the end of the game
+	bool black;                 // Whether black is to move
+	int8_t result;              // Final disc difference for the player to move
+	uint8_t ply;
+} wthor_record_t;
+
+/**
+ * Iterates over the positions of all valid games in a file, game by game.
+ * Games that do not replay are skipped and counted.
+ */
+typedef struct {
+	const wthor_file_t *file;
+	uint32_t game;              // The next game to replay
+	wthor_record_t records[WTHOR_MOVES + 1];
+	uint8_t nr_records;
+	uint8_t next;
+	uint32_t nr_invalid;
+} wthor_iterator_t;
+
+/**
+ * Maps the file at the given path and checks its header
+ *
+ * @return Whether the file is a WTHOR game database
+ */
+bool open_wthor(const char *path, wthor_file_t *file);
+void close_wthor(wthor_file_t *file);
+
+/**
+ * Replays a game from the initial position. Passes are played whenever the
+ * player to move has no legal move.
+ *
+ * @param[in] The game
+ * @param[out] The position before every move and the final position, may be NULL
+ * @param[out] The number of records, may be NULL
+ * @return WTHOR_OK if every move is legal and the final score matches the score in the file
+ */
+wthor_status_t replay_wthor_game(const wthor_game_t *game, wthor_record_t *records, uint8_t *nr_records);
+
+void start_wthor_iterator(const wthor_file_t *file, wthor_iterator_t *iterator);
+
+/**
+ * @param[in,out] The iterator
+ * @param[out] The next position
+ * @return False after the last position of the last game
+ */
+bool next_wthor_record(wthor_iterator_t *iterator, wthor_record_t *record);
+
+#endif
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../ai/ai.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../ai/solved.hpp"
+#include "../lib/state_t.hpp"
+#include "pool.hpp"
+
+/**
+ * Analyses a file of positions on all cores. Positions are read in chunks.
+ * The positions of a chunk are reduced to their canonical boards, so
+ * positions that are the same up to symmetry are searched only once, and the
+ * unique positions are searched in parallel. The results are written in the
+ * order of the input, one line per position:
+ *
+ *     <player> <opponent> <move> <score> <depth> <nodes>
+ *
+ * The move is "pass" when the player to move has no move. Positions are read
+ * as lines of two bitboards, the player to move first, as for the position
+ * command of oooo. With --binary they are read as pairs of 64-bit integers
+ * in the byte order of the machine instead.
+ */
+
+#define DEFAULT_CHUNK 65536
+
+typedef struct {
+	board_t board;          // Canonical
+	uint8_t symmetry;       // From the input to the canonical board
+	uint32_t unique;        // Index of the canonical board in the chunk
+} position_t;
+
+typedef struct {
+	double score;
+	uint64_t nodes;
+	uint8_t move;           // On the canonical board, 64 for a pass
+	uint8_t depth;
+} result_t;
+
+static search_limits_t limits = {.move_time_ms = 3600000, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+static bool binary = false;
+static evaluator_t evaluator = CLASSIC;
+static uint8_t max_depth = 64;
+static uint8_t lmr_endgame = 0;         // 0 keeps the default of the search
+
+// The last completed iteration of the search of a worker
+static thread_local search_info_t last_info;
+static thread_local bool have_info;
+
+// The chunk that is being searched
+static std::vector<result_t> results;
+
+static void collect_info(const search_info_t *info) {
+	last_info = *info;
+	have_info = true;
+}
+
+/**
+ * The search of the calling worker, set up the first time it is used
+ */
+static Search *worker_search(void) {
+	static thread_local Search search;
+	static thread_local bool ready = false;
+	if (!ready) {
+		search.set_evaluator(evaluator);
+		search.set_max_depth(max_depth);
+		if (lmr_endgame > 0)
+			search.set_lmr_endgame(lmr_endgame);
+		search.set_info_callback(collect_info);
+		ready = true;
+	}
+	return &search;
+}
+
+/**
+ * Searches the board in a worker. A forced move or a pass is played without a
+ * search, and the position after it is searched instead. A finished game is
+ * scored by its discs.
+ *
+ * @return The score for the player to move
+ */
+static double search(board_t board, result_t *result) {
+	uint64_t valid = get_valid_moves(board);
+	if (valid == 0) {
+		result->move = 64;
+
+		board_t passed = board;
+		switch_boards(&passed);
+		if (!has_valid_move(passed))
+			return (count(board.player) - count(board.opponent)) * 8192.0;
+
+		result_t ignored;
+		memset(&ignored, 0, sizeof(ignored));
+		double score = -search(passed, &ignored);
+		result->depth = ignored.depth;
+		result->nodes = ignored.nodes;
+		return score;
+	}
+
+	if (count(valid) == 1) {
+		uint8_t move = __builtin_ctzll(valid);
+		result->move = move;
+
+		result_t ignored;
+		memset(&ignored, 0, sizeof(ignored));
+		board_t child = board;
+		do_move(&child, move);
+		switch_boards(&child);
+
+		double score;
+		if (has_valid_move(child)) {
+			score = -search(child, &ignored);
+		} else {
+			switch_boards(&child);
+			if (has_valid_move(child))
+				score = search(child, &ignored);
+			else
+				score = (count(child.player) - count(child.opponent)) * 8192.0;
+		}
+		result->depth = ignored.depth + 1;
+		result->nodes = ignored.nodes;
+		return score;
+	}
+
+	Search *worker = worker_search();
+	have_info = false;
+	worker->set_position(board);
+	int8_t choice = worker->run(&limits);
+	worker->end(false);
+
+	result->move = choice;
+	if (!have_info)
+		return 0;
+
+	result->depth = last_info.depth;
+	result->nodes = last_info.nodes;
+	return last_info.score;
+}
+
+static void work(const void *job, void *out) {
+	result_t *result = (result_t *) out;
+	result->score = search(*(const board_t *) job, result);
+}
+
+static void done(size_t index, const void *out) {
+	results[index] = *(const result_t *) out;
+}
+
+static bool read_position(FILE *file, board_t *board) {
+	if (binary)
+		return fread(board, sizeof(*board), 1, file) == 1;
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char *end;
+		board->player = strtoull(line, &end, 0);
+		if (end == line)
+			continue;
+		board->opponent = strtoull(end, NULL, 0);
+		return true;
+	}
+	return false;
+}
+
+static bool compare_boards(const board_t &a, const board_t &b) {
+	if (a.player != b.player)
+		return a.player < b.player;
+	return a.opponent < b.opponent;
+}
+
+static bool equal_boards(const board_t &a, const board_t &b) {
+	return a.player == b.player && a.opponent == b.opponent;
+}
+
+/**
+ * Writes the result of a position, with the move turned back from the
+ * canonical board to the board as it was read
+ */
+static void write_result(FILE *output, board_t board, uint8_t symmetry, const result_t *result) {
+	char move[5] = "pass";
+	uint64_t valid = get_valid_moves(board);
+	for (uint8_t i = 0; result->move < 64 && i < 64; ++i) {
+		if (is_set(valid, i) && transform_square(i, symmetry) == result->move) {
+			from_coordinate(i, &move[0], &move[1]);
+			move[2] = '\0';
+			break;
+		}
+	}
+
+	fprintf(output, "%" PRIu64 " %" PRIu64 " %s %.0f %" PRIu8 " %" PRIu64 "\n",
+			board.player, board.opponent, move, result->score, result->depth, result->nodes);
+}
+
+static double seconds_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1.0e9;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./analyse.out <positions> [--output <file>] [--binary]\n"
+			"                     [--depth <n> | --nodes <n> | --time <ms> | --solve]\n"
+			"                     [--workers <n>] [--chunk <positions>] [--solved <log>]\n"
+			"                     [--patterns <weights>] [--nnue <network>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		usage();
+
+	FILE *input = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+	if (input == NULL) {
+		fprintf(stderr, "ERROR: could not open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	const char *output_path = NULL;
+	unsigned workers = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t chunk = DEFAULT_CHUNK;
+	uint8_t depth = 10;
+	bool budget = false;
+
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "--binary") == 0) {
+			binary = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--solve") == 0) {
+			// Without reductions a search to the end of the game is exact
+			depth = 64;
+			lmr_endgame = 64;
+			continue;
+		}
+
+		if (i + 1 >= argc)
+			usage();
+		const char *option = argv[i++];
+		const char *value = argv[i];
+
+		if (strcmp(option, "--output") == 0) {
+			output_path = value;
+		} else if (strcmp(option, "--depth") == 0) {
+			depth = atoi(value);
+		} else if (strcmp(option, "--nodes") == 0) {
+			limits.max_nodes = strtoull(value, NULL, 10);
+			budget = true;
+		} else if (strcmp(option, "--time") == 0) {
+			limits.move_time_ms = strtoull(value, NULL, 10);
+			budget = true;
+		} else if (strcmp(option, "--workers") == 0) {
+			workers = atoi(value);
+		} else if (strcmp(option, "--chunk") == 0) {
+			chunk = strtoull(value, NULL, 10);
+		} else if (strcmp(option, "--solved") == 0) {
+			if (!open_solved(value))
+				usage();
+		} else if (strcmp(option, "--patterns") == 0 && load_patterns(value)) {
+			evaluator = PATTERN;
+		} else if (strcmp(option, "--nnue") == 0 && load_nnue(value)) {
+			evaluator = NNUE;
+		} else {
+			usage();
+		}
+	}
+
+	if (depth < 1 || workers < 1 || chunk < 1)
+		usage();
+
+	FILE *output = output_path == NULL ? stdout : fopen(output_path, "w");
+	if (output == NULL) {
+		fprintf(stderr, "ERROR: could not open %s\n", output_path);
+		return EXIT_FAILURE;
+	}
+
+	// A node or time budget searches as deep as the budget allows
+	max_depth = budget || depth >= 64 ? 64 : depth + 1;
+	start_pool(workers, work, sizeof(board_t), sizeof(result_t));
+
+	struct timespec start_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	uint64_t nr_positions = 0;
+	uint64_t nr_searched = 0;
+
+	std::vector<board_t> boards;
+	std::vector<position_t> positions;
+	std::vector<board_t> unique;
+
+	while (true) {
+		boards.clear();
+		board_t board;
+		while (boards.size() < chunk && read_position(input, &board))
+			boards.push_back(board);
+		if (boards.empty())
+			break;
+
+		positions.resize(boards.size());
+		unique.clear();
+		for (size_t i = 0; i < boards.size(); ++i) {
+			positions[i].board = canonical_board(boards[i], &positions[i].symmetry);
+			unique.push_back(positions[i].board);
+		}
+
+		std::sort(unique.begin(), unique.end(), compare_boards);
+		unique.erase(std::unique(unique.begin(), unique.end(), equal_boards), unique.end());
+		for (position_t &position : positions)
+			position.unique = std::lower_bound(unique.begin(), unique.end(), position.board, compare_boards) - unique.begin();
+
+		results.assign(unique.size(), result_t());
+		run_pool(unique.data(), unique.size(), done);
+
+		for (size_t i = 0; i < boards.size(); ++i)
+			write_result(output, boards[i], positions[i].symmetry, &results[positions[i].unique]);
+		fflush(output);
+
+		nr_positions += boards.size();
+		nr_searched += unique.size();
+		double seconds = seconds_since(&start_time);
+		fprintf(stderr, "%" PRIu64 " positions, %" PRIu64 " searched, %.1f s, %.1f positions/s\n",
+				nr_positions, nr_searched, seconds, nr_positions / (seconds > 0 ? seconds : 1));
+	}
+
+	stop_pool();
+	if (output != stdout)
+		fclose(output);
+	if (input != stdin)
+		fclose(input);
+	return EXIT_SUCCESS;
+}
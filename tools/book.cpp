@@ -0,0 +1,444 @@
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "../ai/ai.hpp"
+#include "../ai/book.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../lib/state_t.hpp"
+#include "../lib/wthor.hpp"
+#include "pool.hpp"
+
+/**
+ * Grows an opening book. Starting from the initial position, the positions
+ * of every ply are searched in parallel at a fixed depth, and the best moves
+ * of each position are added to the book as the positions of the next ply.
+ * The positions of imported games are added as well, with how often they
+ * were won. Games are imported from text files with a game per line, or from
+ * WTHOR databases (.wtb).
+ *
+ * The book is saved after every ply and every few seconds. Positions that are
+ * already in the book at the requested depth are not searched again, so an
+ * interrupted run continues where it stopped when it is started again.
+ */
+
+#define MAX_WIDTH 8
+
+typedef std::pair<uint64_t, uint64_t> book_key_t;
+
+typedef struct {
+	int32_t score;
+	uint8_t move;
+	uint8_t depth;
+	uint8_t nr_moves;
+	uint8_t moves[MAX_WIDTH];    // The moves to add to the book, best first
+} result_t;
+
+static const char *book_path = NULL;
+static unsigned plies = 12;
+static uint8_t depth = 12;
+static uint8_t width = 2;
+static uint64_t move_time_ms = 3600000;
+static unsigned save_seconds = 60;
+static evaluator_t evaluator = CLASSIC;
+
+static std::map<book_key_t, book_entry_t> book;
+
+// The ply that is being searched
+static const board_t *jobs;
+static bool expand;
+static size_t nr_done;
+static time_t last_save;
+
+// The infos of the last completed iteration of the search of a worker
+static thread_local search_info_t infos[64];
+static thread_local uint8_t nr_infos;
+static thread_local uint8_t info_depth;
+
+static book_key_t key_of(board_t board) {
+	return book_key_t(board.player, board.opponent);
+}
+
+static book_entry_t *entry_of(board_t canonical) {
+	book_key_t key = key_of(canonical);
+	auto it = book.find(key);
+	if (it != book.end())
+		return &it->second;
+
+	book_entry_t entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.player = canonical.player;
+	entry.opponent = canonical.opponent;
+	entry.move = BOOK_NO_MOVE;
+	return &book.insert(std::make_pair(key, entry)).first->second;
+}
+
+/**
+ * The position after the move, from the perspective of the player to move.
+ * A pass is played right away.
+ *
+ * @return False if the game is over after the move
+ */
+static bool play_move(board_t board, uint8_t move, board_t *child) {
+	do_move(&board, move);
+	switch_boards(&board);
+	if (!has_valid_move(board)) {
+		switch_boards(&board);
+		if (!has_valid_move(board))
+			return false;
+	}
+	*child = board;
+	return true;
+}
+
+/**
+ * Whether any position after a move on the board is in the book
+ */
+static bool has_children(board_t board) {
+	uint64_t valid = get_valid_moves(board);
+	for (uint8_t i = 0; i < 64; ++i) {
+		board_t child;
+		if (is_set(valid, i) && play_move(board, i, &child) && book.count(key_of(canonical_board(child, NULL))) > 0)
+			return true;
+	}
+	return false;
+}
+
+static void save_book(void) {
+	std::vector<book_entry_t> entries;
+	entries.reserve(book.size());
+	for (auto &it : book)
+		entries.push_back(it.second);
+
+	if (!write_book(book_path, entries.data(), entries.size()))
+		fprintf(stderr, "ERROR: could not write %s\n", book_path);
+	last_save = time(NULL);
+}
+
+static void collect_info(const search_info_t *info) {
+	if (info->depth != info_depth) {
+		info_depth = info->depth;
+		nr_infos = 0;
+	}
+	infos[nr_infos++] = *info;
+}
+
+/**
+ * The search of the calling worker, set up the first time it is used
+ */
+static Search *worker_search(void) {
+	static thread_local Search search;
+	static thread_local bool ready = false;
+	if (!ready) {
+		search.set_evaluator(evaluator);
+		search.set_max_depth(depth + 1);
+		search.set_multi_pv(width);
+		search.set_info_callback(collect_info);
+		ready = true;
+	}
+	return &search;
+}
+
+/**
+ * Searches the board in a worker. A forced move is played without a search,
+ * and the position after it is searched instead.
+ *
+ * @return The score for the player to move
+ */
+static double search(board_t board, result_t *result) {
+	uint64_t valid = get_valid_moves(board);
+
+	if (count(valid) == 1) {
+		uint8_t move = __builtin_ctzll(valid);
+		result->move = move;
+		result->depth = depth;
+		result->nr_moves = 1;
+		result->moves[0] = move;
+
+		result_t ignored;
+		memset(&ignored, 0, sizeof(ignored));
+		board_t child = board;
+		do_move(&child, move);
+		switch_boards(&child);
+		if (has_valid_move(child))
+			return -search(child, &ignored);
+		switch_boards(&child);
+		if (has_valid_move(child))
+			return search(child, &ignored);
+		return (count(child.player) - count(child.opponent)) * 8192.0;
+	}
+
+	Search *worker = worker_search();
+	search_limits_t limits = {.move_time_ms = move_time_ms, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+	nr_infos = 0;
+	info_depth = 0;
+	worker->set_position(board);
+	int8_t choice = worker->run(&limits);
+	worker->end(false);
+	if (nr_infos == 0) {
+		result->move = choice;
+		result->depth = 0;
+		return 0;
+	}
+
+	// A search that ran out of empty squares is as deep as it gets
+	uint8_t empties = count(~(board.player | board.opponent));
+	result->move = infos[0].pv[0];
+	result->depth = info_depth >= depth || info_depth >= empties ? depth : info_depth;
+	for (uint8_t i = 0; i < nr_infos && result->nr_moves < width; ++i) {
+		if (!infos[i].upper_bound)
+			result->moves[result->nr_moves++] = infos[i].pv[0];
+	}
+	return infos[0].score;
+}
+
+static void work(const void *job, void *out) {
+	result_t *result = (result_t *) out;
+	result->score = (int32_t) search(*(const board_t *) job, result);
+}
+
+static void done(size_t index, const void *out) {
+	const result_t *result = (const result_t *) out;
+	board_t board = jobs[index];
+
+	book_entry_t *entry = entry_of(board);
+	entry->score = result->score;
+	entry->move = result->move;
+	entry->depth = result->depth;
+
+	// The positions of the next ply are added right away, so they are saved
+	// together with this one
+	for (uint8_t i = 0; expand && i < result->nr_moves; ++i) {
+		board_t child;
+		if (play_move(board, result->moves[i], &child))
+			entry_of(canonical_board(child, NULL));
+	}
+
+	nr_done++;
+	if (time(NULL) - last_save >= save_seconds)
+		save_book();
+}
+
+/**
+ * Adds the positions of a game to the book. A game is a list of moves such
+ * as f5d6c3, the moves may be separated by spaces.
+ *
+ * @return False if the game contains an illegal move
+ */
+static bool import_game(const char *line) {
+	board_t board = {.player = 0x0000000810000000ULL, .opponent = 0x0000001008000000ULL};
+	bool black_to_move = true;
+	std::vector<std::pair<board_t, bool>> positions;
+	bool legal = true;
+
+	for (const char *c = line; c[0] != '\0' && c[1] != '\0'; ++c) {
+		char column = c[0] | 0x20;
+		char row = c[1];
+		if (column < 'a' || column > 'h' || row < '1' || row > '8')
+			continue;
+		c++;
+
+		if (!has_valid_move(board)) {
+			switch_boards(&board);
+			black_to_move = !black_to_move;
+		}
+
+		uint8_t move = to_coordinate(column, row);
+		if (!is_set(get_valid_moves(board), move)) {
+			legal = false;
+			break;
+		}
+
+		if (positions.size() <= plies)
+			positions.push_back(std::make_pair(board, black_to_move));
+
+		do_move(&board, move);
+		switch_boards(&board);
+		black_to_move = !black_to_move;
+	}
+
+	// Only finished games have a winner
+	board_t other = board;
+	switch_boards(&other);
+	bool over = legal && !has_valid_move(board) && !has_valid_move(other);
+	int black_lead = (count(board.player) - count(board.opponent)) * (black_to_move ? 1 : -1);
+
+	for (auto &position : positions) {
+		book_entry_t *entry = entry_of(canonical_board(position.first, NULL));
+		entry->games++;
+		if (over && (position.second ? black_lead > 0 : black_lead < 0))
+			entry->wins++;
+	}
+	return legal;
+}
+
+/**
+ * Adds the positions of the valid games of a WTHOR database to the book
+ */
+static void import_wthor(const char *path) {
+	wthor_file_t file;
+	if (!open_wthor(path, &file))
+		exit(EXIT_FAILURE);
+
+	wthor_iterator_t iterator;
+	wthor_record_t record;
+	start_wthor_iterator(&file, &iterator);
+	while (next_wthor_record(&iterator, &record)) {
+		if (record.ply > plies)
+			continue;
+
+		book_entry_t *entry = entry_of(canonical_board(record.board, NULL));
+		entry->games++;
+		if (record.result > 0)
+			entry->wins++;
+	}
+
+	printf("Imported %" PRIu32 " games from %s (%" PRIu32 " invalid, skipped)\n", file.nr_games - iterator.nr_invalid, path, iterator.nr_invalid);
+	close_wthor(&file);
+}
+
+static void import_games(const char *path) {
+	size_t length = strlen(path);
+	if (length > 4 && strcmp(path + length - 4, ".wtb") == 0) {
+		import_wthor(path);
+		return;
+	}
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "ERROR: could not open %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	char line[1024];
+	unsigned games = 0;
+	unsigned illegal = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		games++;
+		if (!import_game(line))
+			illegal++;
+	}
+	fclose(file);
+
+	printf("Imported %u games from %s (%u with illegal moves, cut short)\n", games, path, illegal);
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./book.out <book> [--plies <n>] [--depth <n>] [--width <n>] [--time <ms>]\n"
+			"                  [--workers <n>] [--save <seconds>] [--import <games>]\n"
+			"                  [--patterns <weights>] [--nnue <network>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		usage();
+	book_path = argv[1];
+
+	unsigned workers = sysconf(_SC_NPROCESSORS_ONLN);
+	std::vector<const char *> imports;
+
+	for (int i = 2; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "--plies") == 0)
+			plies = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--depth") == 0)
+			depth = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--width") == 0)
+			width = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--time") == 0)
+			move_time_ms = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--workers") == 0)
+			workers = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--save") == 0)
+			save_seconds = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--import") == 0)
+			imports.push_back(argv[i + 1]);
+		else if (strcmp(argv[i], "--patterns") == 0 && load_patterns(argv[i + 1]))
+			evaluator = PATTERN;
+		else if (strcmp(argv[i], "--nnue") == 0 && load_nnue(argv[i + 1]))
+			evaluator = NNUE;
+		else
+			usage();
+	}
+
+	if (width < 1 || width > MAX_WIDTH || depth < 1 || workers < 1)
+		usage();
+
+	// Resume from the book as it is
+	if (load_book(book_path)) {
+		uint32_t nr_entries;
+		const book_entry_t *entries = book_entries(&nr_entries);
+		for (uint32_t i = 0; i < nr_entries; ++i)
+			book[book_key_t(entries[i].player, entries[i].opponent)] = entries[i];
+		unload_book();
+		printf("Resuming with %zu positions from %s\n", book.size(), book_path);
+	}
+
+	for (const char *path : imports)
+		import_games(path);
+
+	start_pool(workers, work, sizeof(board_t), sizeof(result_t));
+
+	board_t start = {.player = 0x0000000810000000ULL, .opponent = 0x0000001008000000ULL};
+	std::vector<board_t> level = {canonical_board(start, NULL)};
+	entry_of(level[0]);
+	last_save = time(NULL);
+
+	for (unsigned ply = 0; !level.empty(); ++ply) {
+		// The leaves of an earlier run with fewer plies are searched again to
+		// find the moves to expand
+		expand = ply < plies;
+		std::vector<board_t> searches;
+		for (board_t board : level) {
+			if (entry_of(board)->depth < depth || (expand && !has_children(board)))
+				searches.push_back(board);
+		}
+
+		jobs = searches.data();
+		nr_done = 0;
+
+		struct timespec start_time, end_time;
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		run_pool(searches.data(), searches.size(), done);
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		save_book();
+
+		double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1.0e9;
+		printf("Ply %u: %zu positions, %zu searched in %.1f s (%.2f positions/s), book has %zu positions\n",
+				ply, level.size(), searches.size(), seconds, searches.size() / (seconds > 0 ? seconds : 1), book.size());
+		fflush(stdout);
+
+		if (ply == plies)
+			break;
+
+		// The next ply consists of every position after a move that is in the
+		// book, which includes the positions of imported games
+		std::set<book_key_t> seen;
+		std::vector<board_t> next;
+		for (board_t board : level) {
+			uint64_t valid = get_valid_moves(board);
+			for (uint8_t i = 0; i < 64; ++i) {
+				board_t child;
+				if (!is_set(valid, i) || !play_move(board, i, &child))
+					continue;
+
+				child = canonical_board(child, NULL);
+				if (book.count(key_of(child)) > 0 && seen.insert(key_of(child)).second)
+					next.push_back(child);
+			}
+		}
+		level = next;
+	}
+
+	stop_pool();
+	return EXIT_SUCCESS;
+}
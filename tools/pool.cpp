@@ -0,0 +1,99 @@
+#include "pool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+static std::vector<std::thread> workers;
+static pool_work_t work_function;
+static size_t job_size;
+static size_t result_size;
+
+static std::mutex lock;
+static std::condition_variable job_ready;
+static std::condition_variable result_ready;
+static bool stopping = false;
+
+// The jobs that are being run, and a result for every one of them
+static const char *jobs = NULL;
+static char *results = NULL;
+static size_t nr_jobs = 0;
+static size_t next_job = 0;
+
+// The jobs whose results have not been passed to done yet
+static std::vector<size_t> finished;
+
+static void worker_loop(void) {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		job_ready.wait(guard, [] { return stopping || next_job < nr_jobs; });
+		if (next_job >= nr_jobs)
+			break;
+
+		// Every job has a result of its own, so it is written without the lock
+		size_t index = next_job++;
+		const void *job = jobs + index * job_size;
+		void *result = results + index * result_size;
+		guard.unlock();
+
+		memset(result, 0, result_size);
+		work_function(job, result);
+
+		guard.lock();
+		finished.push_back(index);
+		result_ready.notify_one();
+	}
+}
+
+void start_pool(unsigned nr_workers, pool_work_t work, size_t job_bytes, size_t result_bytes) {
+	work_function = work;
+	job_size = job_bytes;
+	result_size = result_bytes;
+	stopping = false;
+
+	for (unsigned i = 0; i < nr_workers; ++i)
+		workers.push_back(std::thread(worker_loop));
+}
+
+void run_pool(const void *job_data, size_t count, pool_done_t done) {
+	std::vector<char> buffer(count * result_size);
+	std::vector<size_t> ready;
+
+	std::unique_lock<std::mutex> guard(lock);
+	jobs = (const char *) job_data;
+	results = buffer.data();
+	nr_jobs = count;
+	next_job = 0;
+	job_ready.notify_all();
+
+	for (size_t nr_done = 0; nr_done < count; nr_done += ready.size()) {
+		ready.clear();
+		result_ready.wait(guard, [] { return !finished.empty(); });
+		ready.swap(finished);
+
+		// The workers go on with the next jobs meanwhile
+		guard.unlock();
+		for (size_t index : ready)
+			done(index, buffer.data() + index * result_size);
+		guard.lock();
+	}
+
+	jobs = NULL;
+	results = NULL;
+	nr_jobs = 0;
+	next_job = 0;
+}
+
+void stop_pool(void) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	job_ready.notify_all();
+
+	for (std::thread &worker : workers)
+		worker.join();
+	workers.clear();
+}
@@ -0,0 +1,48 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A pool of worker threads. Every worker searches with a Search of its own
+ * (see ai.hpp), so searches truly run in parallel, and the workers only share
+ * the evaluation weights and the solved position log. Jobs and results are
+ * fixed size structs.
+ */
+
+/**
+ * Runs one job on a worker thread, at the same time as the other workers
+ *
+ * @param[in] The job
+ * @param[out] The result, zeroed
+ */
+typedef void (*pool_work_t)(const void *job, void *result);
+
+/**
+ * Receives a result on the thread that runs the pool, in the order the jobs
+ * finish
+ *
+ * @param[in] Index of the job
+ * @param[in] The result
+ */
+typedef void (*pool_done_t)(size_t index, const void *result);
+
+/**
+ * Starts the workers. Everything the workers need, such as the evaluation
+ * weights, should be loaded before.
+ */
+void start_pool(unsigned nr_workers, pool_work_t work, size_t job_size, size_t result_size);
+
+/**
+ * Runs all jobs on the workers and waits until every result has been passed
+ * to done
+ */
+void run_pool(const void *jobs, size_t nr_jobs, pool_done_t done);
+
+/**
+ * Stops the workers and waits for them to exit
+ */
+void stop_pool(void);
+
+#endif
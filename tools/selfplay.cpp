@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../ai/ai.hpp"
+#include "../ai/nnue.hpp"
+#include "../ai/patterns.hpp"
+#include "../lib/position_file.hpp"
+#include "../lib/state_t.hpp"
+#include "pool.hpp"
+
+/**
+ * Generates training data by self-play. Every game starts with a number of
+ * random moves, so games do not repeat, and is then played out by the engine
+ * at a fixed depth. Every position of every game is appended to a position
+ * file (see position_file.hpp) with the score of its search and the final
+ * result of the game. The positions of the random opening have no score.
+ *
+ * Games are played in a pool of worker threads, each playing one game at a
+ * time with a search of its own.
+ */
+
+// Every move and the final position
+#define MAX_RECORDS 61
+
+typedef struct {
+	uint64_t seed;
+} job_t;
+
+typedef struct {
+	uint8_t nr_records;
+	position_record_t records[MAX_RECORDS];
+} result_t;
+
+static const char *output_path = NULL;
+static uint8_t random_plies = 8;
+#define UNTIMED_MS 3600000
+
+static uint64_t move_time_ms = UNTIMED_MS;
+static unsigned flush_games = 256;
+static evaluator_t evaluator = CLASSIC;
+static uint8_t max_depth = 64;
+
+static std::vector<position_record_t> pending;
+static uint64_t nr_games = 0;
+static uint64_t nr_positions = 0;
+static unsigned pending_games = 0;
+static bool write_ok = true;
+static struct timespec start_time;
+
+// The last completed iteration of the search of a worker
+static thread_local search_info_t last_info;
+static thread_local bool have_info;
+
+static void collect_info(const search_info_t *info) {
+	last_info = *info;
+	have_info = true;
+}
+
+/**
+ * The search of the calling worker, set up the first time it is used
+ */
+static Search *worker_search(void) {
+	static thread_local Search search;
+	static thread_local bool ready = false;
+	if (!ready) {
+		search.set_evaluator(evaluator);
+		search.set_max_depth(max_depth);
+		search.set_info_callback(collect_info);
+		ready = true;
+	}
+	return &search;
+}
+
+/**
+ * xorshift64*, seeded per game so a run can be reproduced
+ */
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint8_t random_move(uint64_t valid, uint64_t *state) {
+	uint8_t n = next_random(state) % count(valid);
+	for (; n > 0; --n)
+		valid &= valid - 1;
+	return __builtin_ctzll(valid);
+}
+
+static void play_game(const void *job, void *out) {
+	result_t *result = (result_t *) out;
+	uint64_t state = ((const job_t *) job)->seed | 1;
+	Search *search = worker_search();
+	search_limits_t limits = {.move_time_ms = move_time_ms, .remaining_ms = 0, .increment_ms = 0, .moves_to_go = 0, .max_nodes = 0, .max_depth = 0, .infinite = false};
+
+	board_t board = {.player = 0x0000000810000000ULL, .opponent = 0x0000001008000000ULL};
+	bool black = true;
+	bool black_to_move[MAX_RECORDS];
+
+	for (uint8_t ply = 0; result->nr_records < MAX_RECORDS - 1; ++ply) {
+		uint64_t valid = get_valid_moves(board);
+		if (valid == 0) {
+			switch_boards(&board);
+			black = !black;
+			valid = get_valid_moves(board);
+			if (valid == 0)
+				break;
+		}
+
+		position_record_t *record = &result->records[result->nr_records];
+		black_to_move[result->nr_records++] = black;
+		record->player = board.player;
+		record->opponent = board.opponent;
+		record->score = POSITION_NO_SCORE;
+
+		if (ply < random_plies) {
+			record->move = random_move(valid, &state);
+		} else {
+			have_info = false;
+			search->set_position(board);
+			record->move = search->run(&limits);
+			search->end(false);
+			if (have_info && finite_score(last_info.score))
+				record->score = (int32_t) fmax(fmin(last_info.score, INT32_MAX), INT32_MIN + 1);
+		}
+
+		do_move(&board, record->move);
+		switch_boards(&board);
+		black = !black;
+	}
+
+	position_record_t *last = &result->records[result->nr_records];
+	black_to_move[result->nr_records++] = black;
+	last->player = board.player;
+	last->opponent = board.opponent;
+	last->score = POSITION_NO_SCORE;
+	last->move = POSITION_NO_MOVE;
+
+	// Empty squares go to the winner
+	int8_t black_discs = black ? count(board.player) : count(board.opponent);
+	int8_t white_discs = black ? count(board.opponent) : count(board.player);
+	int8_t empties = 64 - black_discs - white_discs;
+	int8_t black_result = black_discs - white_discs;
+	if (black_result != 0)
+		black_result += black_result > 0 ? empties : -empties;
+
+	for (uint8_t i = 0; i < result->nr_records; ++i)
+		result->records[i].result = black_to_move[i] ? black_result : -black_result;
+}
+
+static void flush(void) {
+	if (!pending.empty() && !append_positions(output_path, pending.data(), pending.size()))
+		write_ok = false;
+	pending.clear();
+	pending_games = 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double seconds = (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec) / 1.0e9;
+	if (seconds <= 0)
+		seconds = 1e-9;
+	printf("%" PRIu64 " games, %" PRIu64 " positions in %.1f s: %.2f games/s, %.1f positions/s\n",
+			nr_games, nr_positions, seconds, nr_games / seconds, nr_positions / seconds);
+	fflush(stdout);
+}
+
+static void done(size_t index, const void *out) {
+	(void) index;
+	const result_t *result = (const result_t *) out;
+
+	pending.insert(pending.end(), result->records, result->records + result->nr_records);
+	nr_games++;
+	nr_positions += result->nr_records;
+	if (++pending_games == flush_games)
+		flush();
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./selfplay.out <positions> [--games <n>] [--random <plies>]\n"
+			"                      [--depth <n> | --time <ms>] [--workers <n>] [--seed <n>]\n"
+			"                      [--flush <games>] [--patterns <weights>] [--nnue <network>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		usage();
+	output_path = argv[1];
+
+	uint64_t games = 1000;
+	uint64_t seed = time(NULL);
+	uint8_t depth = 6;
+	unsigned workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (int i = 2; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (strcmp(argv[i], "--games") == 0)
+			games = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--random") == 0)
+			random_plies = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--depth") == 0)
+			depth = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--time") == 0)
+			move_time_ms = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--workers") == 0)
+			workers = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--seed") == 0)
+			seed = strtoull(argv[i + 1], NULL, 10);
+		else if (strcmp(argv[i], "--flush") == 0)
+			flush_games = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--patterns") == 0 && load_patterns(argv[i + 1]))
+			evaluator = PATTERN;
+		else if (strcmp(argv[i], "--nnue") == 0 && load_nnue(argv[i + 1]))
+			evaluator = NNUE;
+		else
+			usage();
+	}
+
+	if (depth < 1 || workers < 1 || flush_games < 1)
+		usage();
+
+	// With a time per move, the search goes as deep as the time allows
+	bool timed = move_time_ms != UNTIMED_MS;
+	max_depth = timed || depth >= 64 ? 64 : depth + 1;
+
+	start_pool(workers, play_game, sizeof(job_t), sizeof(result_t));
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+	// Every game gets a seed of its own, so the order in which the workers
+	// pick up games does not change the games. The pool holds the results of
+	// all its jobs, so the games are played a flush at a time.
+	std::vector<job_t> jobs;
+	uint64_t state = seed | 1;
+	for (uint64_t played = 0; played < games; played += jobs.size()) {
+		jobs.resize(std::min<uint64_t>(games - played, flush_games));
+		for (job_t &job : jobs)
+			job.seed = next_random(&state);
+		run_pool(jobs.data(), jobs.size(), done);
+	}
+	flush();
+	stop_pool();
+
+	if (!write_ok)
+		fprintf(stderr, "ERROR: could not write %s\n", output_path);
+	return write_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
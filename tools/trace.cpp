@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../lib/state_t.hpp"
+#include "../lib/trace.hpp"
+
+/**
+ * Reads the trace files of builds with TRACE (see trace.hpp).
+ *
+ * json converts a trace to the trace event format of Chrome, to open in
+ * chrome://tracing or Perfetto. Every search is a process and every thread of
+ * it a thread, with its iterations, its searches of the root moves and the
+ * nodes up to --ply plies below them as nested spans.
+ *
+ * summary shows where the pruning fails. Negamax prunes as much as it can when
+ * the first move it searches at a node fails high, so the table lists, by the
+ * remaining depth, how often the nodes failed high, how often on their first
+ * move, and whether the move from the table helped. Every move searched
+ * before the one that failed high was wasted, the nodes that wasted the most
+ * time that way are listed with --top.
+ */
+
+#define PROBE_NAMES 3
+static const char *probe_names[PROBE_NAMES] = {"miss", "shallow", "cutoff"};
+
+// Probe outcomes, see probe_outcome_t in ai.hpp
+#define PROBE_SHALLOW 1
+#define PROBE_CUTOFF 2
+
+// The ply of a record is a byte
+#define MAX_PLIES 256
+
+typedef struct {
+	uint64_t nodes;
+	uint64_t table_cutoffs;
+	uint64_t interior;        // Nodes that searched their moves
+	uint64_t cut;             // Interior nodes that failed high
+	uint64_t first_cut;       // On their first move
+	uint64_t cut_index;       // Sum of the indices of the moves that failed high
+	uint64_t all;             // Interior nodes that failed low
+	uint64_t all_moves;
+	uint64_t table_move_cut;  // Interior nodes with a move from the table that failed high
+	uint64_t table_move_first_cut;
+	uint64_t wasted_ns;       // Of the moves searched before the one that failed high
+} depth_summary_t;
+
+typedef struct {
+	uint32_t search;
+	trace_record_t record;
+	uint64_t wasted_ns;
+} wasted_node_t;
+
+/**
+ * Whether the score is finite, from its bits, as the tools are built with
+ * -ffast-math
+ */
+static bool finite_float(float score) {
+	uint32_t bits;
+	memcpy(&bits, &score, sizeof(bits));
+	return (bits & 0x7F800000) != 0x7F800000;
+}
+
+static void print_score(float score) {
+	if (finite_float(score))
+		printf("%.0f", score);
+	else
+		printf("null");
+}
+
+static void print_move(uint8_t move) {
+	char c, r;
+	from_coordinate(move, &c, &r);
+	printf("%c%c", c, r);
+}
+
+static void print_event(const char *phase, uint32_t pid, const trace_record_t *record) {
+	printf(",\n{\"ph\": \"%s\", \"pid\": %" PRIu32 ", \"tid\": %" PRIu8 ", \"ts\": %.3f", phase, pid, record->thread, record->time_ns / 1000.0);
+}
+
+static void print_json_search(uint32_t pid, const trace_header_t *header, const std::vector<trace_record_t> &records, uint8_t max_ply) {
+	printf(",\n{\"ph\": \"M\", \"pid\": %" PRIu32 ", \"name\": \"process_name\", \"args\": {\"name\": \"search %" PRIu32 "\"}}", pid, pid);
+	for (uint32_t thread = 0; thread < header->threads; ++thread) {
+		printf(",\n{\"ph\": \"M\", \"pid\": %" PRIu32 ", \"tid\": %" PRIu32 ", \"name\": \"thread_name\", \"args\": {\"name\": \"thread %" PRIu32 "\"}}",
+				pid, thread, thread);
+	}
+
+	// With a full ring buffer the start of a span may be gone, its end is
+	// then left out as well
+	std::vector<int> open_roots(header->threads, 0), open_iterations(header->threads, 0);
+	for (const trace_record_t &record : records) {
+		switch (record.kind) {
+			case TRACE_NODE:
+				if (record.ply >= max_ply)
+					break;
+				print_event("X", pid, &record);
+				printf(", \"dur\": %.3f, \"name\": \"ply %" PRIu8 " depth %" PRIu8 "\", \"cat\": \"node\", \"args\": {\"alpha\": ",
+						record.duration_ns / 1000.0, record.ply, record.depth);
+				print_score(record.alpha);
+				printf(", \"beta\": ");
+				print_score(record.beta);
+				printf(", \"value\": ");
+				print_score(record.value);
+				printf(", \"probe\": \"%s\", \"moves\": %" PRIu8 ", \"searched\": %" PRIu8,
+						record.probe < PROBE_NAMES ? probe_names[record.probe] : "none", record.moves, record.searched);
+				if (record.cutoff != TRACE_NO_CUTOFF)
+					printf(", \"cutoff\": %" PRIu8, record.cutoff);
+				printf("}}");
+				break;
+			case TRACE_ROOT_BEGIN:
+			case TRACE_ROOT_END:
+				if (record.kind == TRACE_ROOT_END && open_roots[record.thread]-- <= 0) {
+					open_roots[record.thread] = 0;
+					break;
+				}
+				if (record.kind == TRACE_ROOT_BEGIN)
+					open_roots[record.thread]++;
+				print_event(record.kind == TRACE_ROOT_BEGIN ? "B" : "E", pid, &record);
+				printf(", \"name\": \"");
+				print_move(record.cutoff);
+				printf("\", \"cat\": \"root\", \"args\": {\"depth\": %" PRIu8 "}}", record.depth);
+				break;
+			case TRACE_ITERATION_BEGIN:
+			case TRACE_ITERATION_END:
+				if (record.kind == TRACE_ITERATION_END && open_iterations[record.thread]-- <= 0) {
+					open_iterations[record.thread] = 0;
+					break;
+				}
+				if (record.kind == TRACE_ITERATION_BEGIN)
+					open_iterations[record.thread]++;
+				print_event(record.kind == TRACE_ITERATION_BEGIN ? "B" : "E", pid, &record);
+				printf(", \"name\": \"depth %" PRIu8 "\", \"cat\": \"iteration\"}", record.depth);
+				break;
+		}
+	}
+}
+
+/**
+ * Adds the nodes of a search to the summary. The records of a thread are in
+ * post-order, so the children of a node are the records one ply deeper that
+ * were written since the last node at its own ply.
+ */
+static void summarize_search(uint32_t search, const trace_header_t *header, const std::vector<trace_record_t> &records,
+		depth_summary_t *depths, std::vector<wasted_node_t> *wasted) {
+	std::vector<std::vector<std::vector<const trace_record_t *>>> children(header->threads,
+			std::vector<std::vector<const trace_record_t *>>(MAX_PLIES + 1));
+
+	for (const trace_record_t &record : records) {
+		std::vector<std::vector<const trace_record_t *>> &pending = children[record.thread];
+		if (record.kind == TRACE_ROOT_END) {
+			pending[0].clear();
+			continue;
+		}
+		if (record.kind != TRACE_NODE)
+			continue;
+
+		depth_summary_t *summary = &depths[record.depth];
+		summary->nodes++;
+		if (record.probe == PROBE_CUTOFF)
+			summary->table_cutoffs++;
+
+		std::vector<const trace_record_t *> &own_children = pending[record.ply + 1];
+		if (record.moves > 0) {
+			summary->interior++;
+			bool table_move = record.probe == PROBE_SHALLOW;
+			if (record.cutoff != TRACE_NO_CUTOFF) {
+				summary->cut++;
+				summary->first_cut += record.cutoff == 0;
+				summary->cut_index += record.cutoff;
+				summary->table_move_cut += table_move;
+				summary->table_move_first_cut += table_move && record.cutoff == 0;
+
+				// Everything before the last child was in vain, including a
+				// reduced search of the move that failed high on its re-search
+				uint64_t wasted_ns = 0;
+				for (size_t i = 0; i + 1 < own_children.size(); ++i)
+					wasted_ns += own_children[i]->duration_ns;
+				summary->wasted_ns += wasted_ns;
+				if (wasted_ns > 0)
+					wasted->push_back({search, record, wasted_ns});
+			} else if (record.value <= record.alpha) {
+				summary->all++;
+				summary->all_moves += record.moves;
+			}
+		}
+
+		own_children.clear();
+		pending[record.ply].push_back(&record);
+	}
+}
+
+static void print_summary(const depth_summary_t *depths, std::vector<wasted_node_t> *wasted, size_t top, uint64_t thread_ns) {
+	printf("%5s %11s %7s %11s %6s %6s %7s %6s %8s %9s %9s\n", "depth", "nodes", "tt cut", "interior", "cut", "first",
+			"cut idx", "all", "moves", "tt first", "wasted");
+	for (int depth = 0; depth <= UINT8_MAX; ++depth) {
+		const depth_summary_t *summary = &depths[depth];
+		if (summary->nodes == 0)
+			continue;
+
+		double interior = summary->interior > 0 ? summary->interior : 1;
+		double cut = summary->cut > 0 ? summary->cut : 1;
+		double table_move_cut = summary->table_move_cut > 0 ? summary->table_move_cut : 1;
+		printf("%5d %11" PRIu64 " %6.1f%% %11" PRIu64 " %5.1f%% %5.1f%% %7.2f %5.1f%% %8.2f %8.1f%% %8.1f%%\n",
+				depth, summary->nodes, 100.0 * summary->table_cutoffs / summary->nodes, summary->interior,
+				100.0 * summary->cut / interior, 100.0 * summary->first_cut / cut, summary->cut_index / cut,
+				100.0 * summary->all / interior, summary->all > 0 ? (double) summary->all_moves / summary->all : 0,
+				100.0 * summary->table_move_first_cut / table_move_cut, 100.0 * summary->wasted_ns / (thread_ns > 0 ? thread_ns : 1));
+	}
+	printf("\n");
+	printf("tt cut:   nodes cut off by the table\n");
+	printf("cut:      interior nodes that failed high, first: on their first move, cut idx: mean index of that move\n");
+	printf("all:      interior nodes that failed low, moves: their mean number of moves\n");
+	printf("tt first: nodes with a move from the table that failed high on it, of those that failed high\n");
+	printf("wasted:   time spent on moves before the one that failed high, of the time of all threads\n");
+
+	if (top == 0 || wasted->empty())
+		return;
+
+	size_t nr_top = std::min(top, wasted->size());
+	std::partial_sort(wasted->begin(), wasted->begin() + nr_top, wasted->end(),
+			[](const wasted_node_t &a, const wasted_node_t &b) { return a.wasted_ns > b.wasted_ns; });
+
+	printf("\nMost time wasted before a cutoff:\n");
+	printf("%6s %6s %4s %5s %8s %8s %8s %7s %6s %6s %10s %10s\n", "search", "thread", "ply", "depth", "alpha", "beta",
+			"value", "probe", "cutoff", "moves", "wasted ms", "node ms");
+	for (size_t i = 0; i < nr_top; ++i) {
+		const trace_record_t *record = &(*wasted)[i].record;
+		printf("%6" PRIu32 " %6" PRIu8 " %4" PRIu8 " %5" PRIu8 " %8.0f %8.0f %8.0f %7s %6" PRIu8 " %6" PRIu8 " %10.3f %10.3f\n",
+				(*wasted)[i].search, record->thread, record->ply, record->depth, record->alpha, record->beta, record->value,
+				record->probe < PROBE_NAMES ? probe_names[record->probe] : "none", record->cutoff, record->moves,
+				(*wasted)[i].wasted_ns / 1.0e6, record->duration_ns / 1.0e6);
+	}
+}
+
+/**
+ * The time the threads of a search spent in it
+ */
+static uint64_t thread_time_ns(const trace_header_t *header, const std::vector<trace_record_t> &records) {
+	std::vector<uint64_t> first(header->threads, UINT64_MAX), last(header->threads, 0);
+	for (const trace_record_t &record : records) {
+		uint64_t end = record.time_ns + (record.kind == TRACE_NODE ? record.duration_ns : 0);
+		first[record.thread] = std::min(first[record.thread], record.time_ns);
+		last[record.thread] = std::max(last[record.thread], end);
+	}
+
+	uint64_t time_ns = 0;
+	for (uint32_t thread = 0; thread < header->threads; ++thread) {
+		if (last[thread] > first[thread])
+			time_ns += last[thread] - first[thread];
+	}
+	return time_ns;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./trace.out json <trace> [--ply <n>] > trace.json\n");
+	fprintf(stderr, "       ./trace.out summary <trace> [--top <n>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3)
+		usage();
+
+	bool json = strcmp(argv[1], "json") == 0;
+	if (!json && strcmp(argv[1], "summary") != 0)
+		usage();
+
+	uint8_t max_ply = 2;
+	size_t top = 20;
+	for (int i = 3; i < argc; i += 2) {
+		if (i + 1 >= argc)
+			usage();
+		if (json && strcmp(argv[i], "--ply") == 0)
+			max_ply = atoi(argv[i + 1]);
+		else if (!json && strcmp(argv[i], "--top") == 0)
+			top = atoi(argv[i + 1]);
+		else
+			usage();
+	}
+
+	FILE *file = fopen(argv[2], "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	trace_header_t header;
+	std::vector<trace_record_t> records;
+	uint32_t searches = 0;
+	uint64_t nr_records = 0, dropped = 0, thread_ns = 0;
+	std::vector<depth_summary_t> depths(UINT8_MAX + 1, depth_summary_t());
+	std::vector<wasted_node_t> wasted;
+
+	if (json)
+		printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n{\"ph\": \"M\", \"pid\": 0, \"name\": \"process_name\", \"args\": {\"name\": \"%s\"}}", argv[2]);
+
+	while (read_trace(file, &header, &records)) {
+		searches++;
+		nr_records += header.records;
+		dropped += header.dropped;
+		if (json) {
+			print_json_search(searches, &header, records, max_ply);
+		} else {
+			summarize_search(searches, &header, records, depths.data(), &wasted);
+			thread_ns += thread_time_ns(&header, records);
+		}
+	}
+	bool at_end = feof(file);
+	fclose(file);
+
+	if (json) {
+		printf("\n]}\n");
+	} else {
+		printf("%" PRIu32 " searches, %" PRIu64 " records, %" PRIu64 " dropped\n\n", searches, nr_records, dropped);
+		print_summary(depths.data(), &wasted, top, thread_ns);
+	}
+
+	if (!at_end) {
+		fprintf(stderr, "Not a valid trace after search %" PRIu32 ": %s\n", searches, argv[2]);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
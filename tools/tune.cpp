@@ -0,0 +1,477 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../ai/patterns.hpp"
+#include "../lib/mapped_file.hpp"
+#include "../lib/position_file.hpp"
+#include "../lib/state_t.hpp"
+
+/**
+ * Fits the weights of the pattern evaluation to labelled positions, and
+ * writes them as a weight file that oooo maps at startup (patterns.bin).
+ *
+ * The positions come from position files, such as those written by
+ * selfplay.out or by wthor.out --dump. They are kept as bare boards with a
+ * target, 24 bytes each, and the pattern configurations are extracted again
+ * for every batch. That is cheaper than keeping the 46 configurations of
+ * every position around, and lets tens of millions of positions fit in
+ * memory.
+ *
+ * The evaluation is linear in the weights, so the fit is a least squares
+ * regression on the disc difference, or with --logistic a logistic regression
+ * on the outcome. Every mini-batch is split over the threads. Each thread
+ * sums the gradient of its part in an array of its own, and the sums are
+ * combined for an Adam step. Configurations that are the mirror image of
+ * each other on a pattern that is symmetric itself share one weight.
+ */
+
+#define DEFAULT_PHASES 12
+#define DEFAULT_BATCH 16384
+
+// Discs of evaluation for a change of 1 in the logit of winning
+#define LOGISTIC_SCALE 8.0
+
+#define ADAM_BETA1 0.9
+#define ADAM_BETA2 0.999
+#define ADAM_EPSILON 1e-8
+
+typedef struct {
+	board_t board;
+	float target;           // Disc difference for the player to move
+} sample_t;
+
+static uint32_t entries;
+static uint32_t phases = DEFAULT_PHASES;
+static const pattern_instance_t *instances;
+static uint8_t nr_instances;
+
+// The weight that every configuration of every phase shares with its mirror
+// images, an index into the parameters
+static std::vector<uint32_t> tied;
+static uint32_t nr_parameters;
+
+static std::vector<float> parameters;
+static std::vector<float> adam_m;
+static std::vector<float> adam_v;
+static uint64_t adam_t = 0;
+
+static bool logistic = false;
+static double learning_rate = 0.01;
+static double l2 = 0;
+
+static std::vector<sample_t> samples;
+
+/**
+ * Finds the configurations that are mirror images of each other. A pattern
+ * that some symmetry of the board maps onto itself looks the same through
+ * that symmetry, so a configuration and its image under it get one weight.
+ */
+static void tie_weights(void) {
+	std::vector<uint32_t> representative(entries);
+
+	for (uint8_t type = 0; type < PATTERN_TYPES; ++type) {
+		const pattern_instance_t *base = NULL;
+		for (uint8_t i = 0; i < nr_instances && base == NULL; ++i)
+			if (instances[i].type == type)
+				base = &instances[i];
+
+		uint8_t self[SYMMETRIES];
+		uint8_t nr_self = 0;
+		for (uint8_t symmetry = 0; symmetry < SYMMETRIES; ++symmetry)
+			if (transform(base->mask, symmetry) == base->mask)
+				self[nr_self++] = symmetry;
+
+		uint32_t configurations = 1;
+		for (uint8_t i = 0; i < base->size; ++i)
+			configurations *= 3;
+
+		for (uint32_t configuration = 0; configuration < configurations; ++configuration) {
+			// Put the configuration on the board, digit i on the i-th lowest
+			// square of the pattern
+			board_t board = {.player = 0, .opponent = 0};
+			uint64_t mask = base->mask;
+			for (uint32_t rest = configuration; mask != 0; rest /= 3, mask &= mask - 1) {
+				if (rest % 3 == 1)
+					board.player |= mask & -mask;
+				else if (rest % 3 == 2)
+					board.opponent |= mask & -mask;
+			}
+
+			uint32_t smallest = configuration;
+			for (uint8_t i = 0; i < nr_self; ++i) {
+				uint16_t indices[PATTERN_INSTANCES];
+				pattern_indices(transform_board(board, self[i]), indices);
+				uint8_t instance = base - instances;
+				smallest = std::min(smallest, (uint32_t) indices[instance]);
+			}
+			representative[base->offset + configuration] = base->offset + smallest;
+		}
+	}
+
+	// Number the representatives, in every phase
+	std::vector<uint32_t> number(entries, UINT32_MAX);
+	uint32_t per_phase = 0;
+	for (uint32_t i = 0; i < entries; ++i)
+		if (representative[i] == i)
+			number[i] = per_phase++;
+
+	tied.resize((size_t) phases * entries);
+	for (uint32_t phase = 0; phase < phases; ++phase)
+		for (uint32_t i = 0; i < entries; ++i)
+			tied[(size_t) phase * entries + i] = phase * per_phase + number[representative[i]];
+	nr_parameters = phases * per_phase;
+}
+
+static void load_samples(const char *path, double lambda) {
+	mapped_file_t file;
+	size_t nr_records;
+	const position_record_t *records = map_positions(path, &file, &nr_records);
+	if (records == NULL)
+		exit(EXIT_FAILURE);
+
+	size_t before = samples.size();
+	for (size_t i = 0; i < nr_records; ++i) {
+		const position_record_t *record = &records[i];
+		board_t board = {.player = record->player, .opponent = record->opponent};
+
+		// The evaluation is never asked for full boards
+		uint8_t empties = count(~(board.player | board.opponent));
+		if (empties == 0)
+			continue;
+
+		double target = record->result;
+		if (lambda > 0 && record->score != POSITION_NO_SCORE)
+			target = (1 - lambda) * target + lambda * record->score / 8192.0;
+
+		sample_t sample;
+		memset(&sample, 0, sizeof(sample));
+		sample.board = board;
+		sample.target = target;
+		samples.push_back(sample);
+	}
+
+	unmap_file(&file);
+	printf("Loaded %zu positions from %s\n", samples.size() - before, path);
+}
+
+/**
+ * Starts from the weights in a weight file with the same number of phases.
+ * Mirror images get the mean of their weights.
+ */
+static void load_weights(const char *path) {
+	mapped_file_t file;
+	if (!map_file(path, &file))
+		exit(EXIT_FAILURE);
+
+	const pattern_header_t *header = (const pattern_header_t *) file.data;
+	if (file.size != sizeof(*header) + (size_t) phases * entries * sizeof(int16_t)
+			|| header->phases != phases || header->entries != entries) {
+		fprintf(stderr, "ERROR: %s is not a weight file with %" PRIu32 " phases\n", path, phases);
+		exit(EXIT_FAILURE);
+	}
+
+	const int16_t *weights = (const int16_t *) (header + 1);
+	std::vector<uint32_t> counts(nr_parameters, 0);
+	for (size_t i = 0; i < (size_t) phases * entries; ++i) {
+		parameters[tied[i]] += weights[i] / (float) PATTERN_SCALE;
+		counts[tied[i]]++;
+	}
+	for (uint32_t i = 0; i < nr_parameters; ++i)
+		parameters[i] /= counts[i] > 0 ? counts[i] : 1;
+
+	unmap_file(&file);
+}
+
+static bool save_weights(const char *path) {
+	std::vector<int16_t> weights((size_t) phases * entries);
+	for (size_t i = 0; i < weights.size(); ++i) {
+		double weight = round(parameters[tied[i]] * PATTERN_SCALE);
+		weights[i] = (int16_t) fmax(fmin(weight, INT16_MAX), INT16_MIN);
+	}
+
+	pattern_header_t header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, PATTERN_MAGIC, sizeof(header.magic));
+	header.version = PATTERN_VERSION;
+	header.phases = phases;
+	header.entries = entries;
+
+	std::string tmp_path = std::string(path) + ".tmp";
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(weights.data(), sizeof(int16_t), weights.size(), file) == weights.size();
+	ok = fclose(file) == 0 && ok;
+	return ok && rename(tmp_path.c_str(), path) == 0;
+}
+
+/**
+ * The evaluation of a sample in discs, and the parameters it used
+ */
+static double predict(const sample_t *sample, uint32_t *used) {
+	uint16_t indices[PATTERN_INSTANCES];
+	pattern_indices(sample->board, indices);
+
+	size_t phase_offset = (size_t) pattern_phase(sample->board, phases) * entries;
+	double prediction = 0;
+	for (uint8_t i = 0; i < nr_instances; ++i) {
+		used[i] = tied[phase_offset + instances[i].offset + indices[i]];
+		prediction += parameters[used[i]];
+	}
+	return prediction;
+}
+
+/**
+ * The loss of a prediction, and its derivative to the prediction
+ */
+static double loss(double prediction, double target, double *derivative) {
+	if (!logistic) {
+		double error = prediction - target;
+		*derivative = 2 * error;
+		return error * error;
+	}
+
+	double outcome = target > 0 ? 1 : (target < 0 ? 0 : 0.5);
+	double p = 1 / (1 + exp(-prediction / LOGISTIC_SCALE));
+	*derivative = (p - outcome) / LOGISTIC_SCALE;
+	p = fmin(fmax(p, 1e-12), 1 - 1e-12);
+	return -(outcome * log(p) + (1 - outcome) * log(1 - p));
+}
+
+/**
+ * Sums the gradient of the samples into gradient, and keeps a list of the
+ * parameters that it touched
+ *
+ * @return The summed loss
+ */
+static double accumulate(size_t begin, size_t end, float *gradient, std::vector<uint32_t> *touched) {
+	double total = 0;
+	uint32_t used[PATTERN_INSTANCES];
+
+	for (size_t i = begin; i < end; ++i) {
+		double derivative;
+		total += loss(predict(&samples[i], used), samples[i].target, &derivative);
+		for (uint8_t j = 0; j < nr_instances; ++j) {
+			if (gradient[used[j]] == 0)
+				touched->push_back(used[j]);
+			gradient[used[j]] += derivative;
+		}
+	}
+	return total;
+}
+
+/**
+ * The mean loss over a range of samples, in parallel
+ */
+static double evaluate(size_t begin, size_t end, unsigned threads) {
+	std::vector<double> totals(threads, 0);
+	std::vector<std::thread> pool;
+	size_t part = (end - begin + threads - 1) / threads;
+
+	for (unsigned t = 0; t < threads; ++t) {
+		pool.push_back(std::thread([&, t]() {
+			uint32_t used[PATTERN_INSTANCES];
+			size_t first = std::min(end, begin + t * part);
+			size_t last = std::min(end, first + part);
+			for (size_t i = first; i < last; ++i) {
+				double derivative;
+				totals[t] += loss(predict(&samples[i], used), samples[i].target, &derivative);
+			}
+		}));
+	}
+	for (std::thread &thread : pool)
+		thread.join();
+
+	double total = 0;
+	for (double t : totals)
+		total += t;
+	return end > begin ? total / (end - begin) : 0;
+}
+
+/**
+ * One pass over the training samples
+ *
+ * @return The mean training loss
+ */
+static double train_epoch(size_t nr_training, size_t batch, unsigned threads) {
+	std::vector<std::vector<float>> gradients(threads, std::vector<float>(nr_parameters, 0));
+	std::vector<std::vector<uint32_t>> touched(threads);
+	std::vector<double> totals(threads, 0);
+	std::vector<float> summed(nr_parameters, 0);
+	std::vector<uint32_t> step;
+	double total = 0;
+
+	for (size_t begin = 0; begin < nr_training; begin += batch) {
+		size_t end = std::min(nr_training, begin + batch);
+		size_t part = (end - begin + threads - 1) / threads;
+
+		std::vector<std::thread> pool;
+		for (unsigned t = 0; t < threads; ++t) {
+			pool.push_back(std::thread([&, t]() {
+				size_t first = std::min(end, begin + t * part);
+				size_t last = std::min(end, first + part);
+				totals[t] = accumulate(first, last, gradients[t].data(), &touched[t]);
+			}));
+		}
+		for (std::thread &thread : pool)
+			thread.join();
+
+		// Combine the sparse gradients of the threads, and clear them for the
+		// next batch
+		step.clear();
+		for (unsigned t = 0; t < threads; ++t) {
+			total += totals[t];
+			for (uint32_t i : touched[t]) {
+				if (gradients[t][i] == 0)
+					continue;
+				if (summed[i] == 0)
+					step.push_back(i);
+				summed[i] += gradients[t][i];
+				gradients[t][i] = 0;
+			}
+			touched[t].clear();
+		}
+
+		// Adam, on the parameters in this batch only
+		adam_t++;
+		double correction1 = 1 - pow(ADAM_BETA1, adam_t);
+		double correction2 = 1 - pow(ADAM_BETA2, adam_t);
+		double size = end - begin;
+		for (uint32_t i : step) {
+			double g = summed[i] / size + 2 * l2 * parameters[i];
+			summed[i] = 0;
+
+			adam_m[i] = ADAM_BETA1 * adam_m[i] + (1 - ADAM_BETA1) * g;
+			adam_v[i] = ADAM_BETA2 * adam_v[i] + (1 - ADAM_BETA2) * g * g;
+			parameters[i] -= learning_rate * (adam_m[i] / correction1) / (sqrt(adam_v[i] / correction2) + ADAM_EPSILON);
+		}
+	}
+
+	return nr_training > 0 ? total / nr_training : 0;
+}
+
+static double seconds_since(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1.0e9;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./tune.out <weights> <positions>... [--epochs <n>] [--phases <n>]\n"
+			"                  [--batch <n>] [--rate <r>] [--l2 <r>] [--lambda <r>] [--logistic]\n"
+			"                  [--validation <fraction>] [--threads <n>] [--init <weights>] [--seed <n>]\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3)
+		usage();
+	const char *weights_path = argv[1];
+
+	std::vector<const char *> inputs;
+	const char *init_path = NULL;
+	unsigned epochs = 10;
+	unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t batch = DEFAULT_BATCH;
+	double lambda = 0;
+	double validation = 0.05;
+	uint64_t seed = 1;
+
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "--logistic") == 0) {
+			logistic = true;
+			continue;
+		}
+		if (argv[i][0] != '-') {
+			inputs.push_back(argv[i]);
+			continue;
+		}
+
+		if (i + 1 >= argc)
+			usage();
+		const char *option = argv[i++];
+		const char *value = argv[i];
+
+		if (strcmp(option, "--epochs") == 0)
+			epochs = atoi(value);
+		else if (strcmp(option, "--phases") == 0)
+			phases = atoi(value);
+		else if (strcmp(option, "--batch") == 0)
+			batch = strtoull(value, NULL, 10);
+		else if (strcmp(option, "--rate") == 0)
+			learning_rate = atof(value);
+		else if (strcmp(option, "--l2") == 0)
+			l2 = atof(value);
+		else if (strcmp(option, "--lambda") == 0)
+			lambda = atof(value);
+		else if (strcmp(option, "--validation") == 0)
+			validation = atof(value);
+		else if (strcmp(option, "--threads") == 0)
+			threads = atoi(value);
+		else if (strcmp(option, "--init") == 0)
+			init_path = value;
+		else if (strcmp(option, "--seed") == 0)
+			seed = strtoull(value, NULL, 10);
+		else
+			usage();
+	}
+
+	if (inputs.empty() || phases < 1 || phases > 61 || batch < 1 || threads < 1 || validation < 0 || validation >= 1)
+		usage();
+
+	init_patterns();
+	entries = pattern_entries();
+	instances = pattern_instances(&nr_instances);
+	tie_weights();
+	printf("%" PRIu32 " phases of %" PRIu32 " weights, %" PRIu32 " after tying mirror images\n", phases, entries, nr_parameters);
+
+	parameters.assign(nr_parameters, 0);
+	adam_m.assign(nr_parameters, 0);
+	adam_v.assign(nr_parameters, 0);
+	if (init_path != NULL)
+		load_weights(init_path);
+
+	for (const char *path : inputs)
+		load_samples(path, lambda);
+
+	// Positions of one game follow each other in the files, and should not
+	// end up in the same batch or all in the validation set
+	srand48(seed);
+	for (size_t i = samples.size(); i > 1; --i)
+		std::swap(samples[i - 1], samples[lrand48() % i]);
+
+	size_t nr_validation = samples.size() * validation;
+	size_t nr_training = samples.size() - nr_validation;
+	printf("%zu training and %zu validation positions, %.1f MB\n",
+			nr_training, nr_validation, samples.size() * sizeof(sample_t) / 1.0e6);
+	fflush(stdout);
+
+	for (unsigned epoch = 1; epoch <= epochs; ++epoch) {
+		struct timespec start_time;
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+		double training_loss = train_epoch(nr_training, batch, threads);
+		double validation_loss = evaluate(nr_training, samples.size(), threads);
+		double seconds = seconds_since(&start_time);
+
+		if (!save_weights(weights_path)) {
+			fprintf(stderr, "ERROR: could not write %s\n", weights_path);
+			return EXIT_FAILURE;
+		}
+
+		printf("Epoch %u: training loss %.4f, validation loss %.4f, %.1f s (%.0f positions/s)\n",
+				epoch, training_loss, validation_loss, seconds, nr_training / (seconds > 0 ? seconds : 1));
+		fflush(stdout);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../lib/position_file.hpp"
+#include "../lib/state_t.hpp"
+#include "../lib/wthor.hpp"
+
+/**
+ * Validates WTHOR game databases and dumps their positions. Every game is
+ * replayed, and games with an illegal move or with a final score that does
+ * not match the board are reported. The files are independent and replaying
+ * touches no global state, so every file is handled by the next free thread.
+ *
+ * With --dump, the positions of all valid games are appended to a position
+ * file (see position_file.hpp), in the order of the files on the command
+ * line.
+ */
+
+typedef struct {
+	const char *path;
+	bool opened;
+	uint32_t games;
+	uint32_t illegal;
+	uint32_t wrong_score;
+	uint64_t positions;
+	std::vector<position_record_t> dump;
+} file_result_t;
+
+static std::vector<file_result_t> files;
+static std::atomic<size_t> next_file(0);
+static const char *dump_path = NULL;
+static bool dump_ok = true;
+
+// Dumps are written in the order of the files
+static std::mutex dump_lock;
+static std::condition_variable dump_turn;
+static size_t next_dump = 0;
+
+static void validate(file_result_t *result) {
+	wthor_file_t file;
+	result->opened = open_wthor(result->path, &file);
+	if (!result->opened)
+		return;
+
+	wthor_record_t records[WTHOR_MOVES + 1];
+	for (uint32_t i = 0; i < file.nr_games; ++i) {
+		uint8_t nr_records;
+		wthor_status_t status = replay_wthor_game(&file.games[i], records, &nr_records);
+		if (status == WTHOR_ILLEGAL_MOVE) {
+			result->illegal++;
+			continue;
+		} else if (status == WTHOR_WRONG_SCORE) {
+			result->wrong_score++;
+			continue;
+		}
+
+		result->games++;
+		result->positions += nr_records;
+		for (uint8_t j = 0; dump_path != NULL && j < nr_records; ++j) {
+			position_record_t record;
+			memset(&record, 0, sizeof(record));
+			record.player = records[j].board.player;
+			record.opponent = records[j].board.opponent;
+			record.score = POSITION_NO_SCORE;
+			record.result = records[j].result;
+			record.move = records[j].move;
+			result->dump.push_back(record);
+		}
+	}
+
+	close_wthor(&file);
+}
+
+static void worker(void) {
+	for (size_t i = next_file++; i < files.size(); i = next_file++) {
+		validate(&files[i]);
+
+		if (dump_path == NULL)
+			continue;
+
+		std::unique_lock<std::mutex> lock(dump_lock);
+		dump_turn.wait(lock, [i]() { return next_dump == i; });
+		if (!files[i].dump.empty() && !append_positions(dump_path, files[i].dump.data(), files[i].dump.size()))
+			dump_ok = false;
+		std::vector<position_record_t>().swap(files[i].dump);
+		next_dump++;
+		dump_turn.notify_all();
+	}
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: ./wthor.out [--dump <positions>] [--threads <n>] <file.wtb>...\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+			dump_path = argv[++i];
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (argv[i][0] == '-') {
+			usage();
+		} else {
+			file_result_t result = {};
+			result.path = argv[i];
+			files.push_back(result);
+		}
+	}
+
+	if (files.empty() || threads < 1)
+		usage();
+
+	struct timespec start_time, end_time;
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 0; i < threads && i < files.size(); ++i)
+		pool.push_back(std::thread(worker));
+	for (std::thread &thread : pool)
+		thread.join();
+
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) / 1.0e9;
+
+	uint64_t games = 0, invalid = 0, positions = 0;
+	bool ok = dump_ok;
+	for (const file_result_t &result : files) {
+		if (!result.opened) {
+			ok = false;
+			continue;
+		}
+		printf("%s: %" PRIu32 " games, %" PRIu32 " with an illegal move, %" PRIu32 " with a wrong score\n",
+				result.path, result.games, result.illegal, result.wrong_score);
+		games += result.games + result.illegal + result.wrong_score;
+		invalid += result.illegal + result.wrong_score;
+		positions += result.positions;
+	}
+
+	if (seconds <= 0)
+		seconds = 1e-9;
+	printf("%" PRIu64 " games (%" PRIu64 " invalid), %" PRIu64 " positions in %.3f s: %.0f games/s, %.0f positions/s\n",
+			games, invalid, positions, seconds, games / seconds, positions / seconds);
+	if (!dump_ok)
+		fprintf(stderr, "ERROR: could not write %s\n", dump_path);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -11,6 +11,7 @@
 
 #include "../lib/debug.hpp"
 #include "../lib/state_t.hpp"
+#include "match.hpp"
 
 typedef enum {
 	HUMAN, AI
@@ -182,8 +183,12 @@ void play(void) {
 }
 
 int main(int argc, char *argv[]) {
+	if (argc >= 2 && strcmp(argv[1], "match") == 0)
+		return run_match(argc - 2, argv + 2) ? EXIT_SUCCESS : EXIT_FAILURE;
+
 	if (argc != 3) {
 		std::cout << "Usage: ./interface.out <black_player> <white_player>" << std::endl
+		          << "       ./interface.out match <engine> <engine> [options]" << std::endl
 		          << "Where:" << std::endl
 		          << "\t<black_player> = HUMAN | /path/to/engine" << std::endl
 		          << "\t<white_player> = HUMAN | /path/to/engine" << std::endl;
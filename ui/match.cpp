@@ -0,0 +1,443 @@
+#include "match.hpp"
+
+#include <atomic>
+#include <inttypes.h>
+#include <math.h>
+#include <mutex>
+#include <pstreams/pstream.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <utility>
+#include <vector>
+
+#include "../lib/state_t.hpp"
+#include "sprt.hpp"
+
+// Engines are not punished for the time it takes to pass their move on
+#define TIME_MARGIN_MS 50
+
+typedef enum {
+	GAME_WIN, GAME_DRAW, GAME_LOSS, GAME_ABORTED
+} game_result_t;
+
+typedef struct {
+	std::string engines[2];
+	std::vector<std::pair<std::string, std::string>> options;
+	uint64_t games;
+	unsigned concurrency;
+	uint64_t base_ms;         // 0 for a fixed time per move
+	uint64_t increment_ms;
+	uint64_t move_time_ms;
+	std::vector<std::vector<uint8_t>> openings;
+	bool use_sprt;
+	sprt_t sprt;
+} match_settings_t;
+
+static match_settings_t settings;
+
+static std::atomic<uint64_t> next_game(0);
+static std::atomic<bool> stopped(false);
+
+// The results, shared by the game slots
+static std::mutex results_lock;
+static match_score_t score = {0, 0, 0};
+static uint64_t games_played = 0;
+static sprt_result_t decision = SPRT_CONTINUE;
+static bool failed = false;
+
+static const board_t start_board = {.player = 0x0000000810000000ULL, .opponent = 0x0000001008000000ULL};
+
+static long get_time_ms(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * xorshift64*, so the random openings of a seed are always the same
+ */
+static uint64_t next_random(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static std::string move_text(uint8_t move) {
+	char column, row;
+	from_coordinate(move, &column, &row);
+	return std::string(1, column) + row;
+}
+
+/**
+ * Plays a move, and passes for the next player if they have no move
+ *
+ * @return Whether black is to move afterwards
+ */
+static bool advance(board_t *board, uint8_t move, bool black_to_move) {
+	do_move(board, move);
+	switch_boards(board);
+	if (!has_valid_move(*board)) {
+		switch_boards(board);
+		return black_to_move;
+	}
+	return !black_to_move;
+}
+
+/**
+ * Reads an opening as a list of moves, such as f5d6c3, the moves may be
+ * separated by spaces.
+ *
+ * @return False if a move is illegal, or the game is over before the end
+ */
+static bool parse_opening(const char *line, std::vector<uint8_t> *opening) {
+	board_t board = start_board;
+	bool black_to_move = true;
+
+	for (const char *c = line; c[0] != '\0' && c[1] != '\0'; ++c) {
+		char column = c[0] | 0x20;
+		char row = c[1];
+		if (column < 'a' || column > 'h' || row < '1' || row > '8')
+			continue;
+		c++;
+
+		uint8_t move = to_coordinate(column, row);
+		if (!has_valid_move(board) || !is_set(get_valid_moves(board), move))
+			return false;
+		opening->push_back(move);
+		black_to_move = advance(&board, move, black_to_move);
+	}
+	return !opening->empty() && has_valid_move(board);
+}
+
+static bool load_openings(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return false;
+
+	char line[1024];
+	unsigned invalid = 0;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		std::vector<uint8_t> opening;
+		if (parse_opening(line, &opening))
+			settings.openings.push_back(opening);
+		else if (strspn(line, " \t\r\n") != strlen(line))
+			invalid++;
+	}
+	fclose(file);
+
+	if (invalid > 0)
+		fprintf(stderr, "WARNING: skipped %u invalid openings in %s\n", invalid, path);
+	return !settings.openings.empty();
+}
+
+static void random_openings(uint64_t number, uint8_t plies, uint64_t seed) {
+	uint64_t state = seed | 1;
+
+	for (uint64_t i = 0; i < number; ++i) {
+		board_t board = start_board;
+		bool black_to_move = true;
+		std::vector<uint8_t> opening;
+
+		for (uint8_t ply = 0; ply < plies && has_valid_move(board); ++ply) {
+			uint64_t valid = get_valid_moves(board);
+			uint8_t n = next_random(&state) % count(valid);
+			for (; n > 0; --n)
+				valid &= valid - 1;
+			uint8_t move = __builtin_ctzll(valid);
+			opening.push_back(move);
+			black_to_move = advance(&board, move, black_to_move);
+		}
+		settings.openings.push_back(opening);
+	}
+}
+
+/**
+ * Reads the output of an engine until its move
+ *
+ * @return False if the engine quit
+ */
+static bool read_move(redi::pstream &engine, std::string *move) {
+	std::string line;
+	while (std::getline(engine, line)) {
+		std::istringstream iss(line);
+		std::string command;
+		if (iss >> command && command == "bestmove") {
+			iss >> *move;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Plays one game between the engines of a slot
+ *
+ * @param[in] The engines, the first is the one the result is of
+ * @param[in] Whether the first engine is black
+ * @param[out] Why the game ended
+ * @return The result of the first engine
+ */
+static game_result_t play_game(redi::pstream *engines, const std::vector<uint8_t> &opening, bool first_black, std::string *reason) {
+	board_t board = start_board;
+	bool black_to_move = true;
+
+	for (int i = 0; i < 2; ++i)
+		engines[i] << "position startpos" << std::endl;
+	for (uint8_t move : opening) {
+		for (int i = 0; i < 2; ++i)
+			engines[i] << "play " << move_text(move) << std::endl;
+		black_to_move = advance(&board, move, black_to_move);
+	}
+
+	// The clocks of black and white
+	int64_t clocks[2] = {(int64_t) settings.base_ms, (int64_t) settings.base_ms};
+
+	while (has_valid_move(board)) {
+		int player = black_to_move ? 0 : 1;
+		int engine = black_to_move == first_black ? 0 : 1;
+		game_result_t loss = engine == 0 ? GAME_LOSS : GAME_WIN;
+
+		std::ostringstream go;
+		if (settings.base_ms > 0) {
+			go << "go btime " << clocks[0] << " wtime " << clocks[1]
+			   << " binc " << settings.increment_ms << " winc " << settings.increment_ms;
+		} else {
+			go << "go time " << settings.move_time_ms;
+		}
+
+		long start_ms = get_time_ms();
+		engines[engine] << go.str() << std::endl;
+		std::string move_name;
+		if (!read_move(engines[engine], &move_name)) {
+			*reason = "engine " + std::to_string(engine + 1) + " quit";
+			return GAME_ABORTED;
+		}
+		long used_ms = get_time_ms() - start_ms;
+
+		if (settings.base_ms > 0) {
+			clocks[player] -= used_ms;
+			if (clocks[player] < -TIME_MARGIN_MS) {
+				*reason = std::string(black_to_move ? "black" : "white") + " lost on time";
+				return loss;
+			}
+			clocks[player] += settings.increment_ms;
+		} else if (used_ms > (long) settings.move_time_ms + TIME_MARGIN_MS) {
+			*reason = std::string(black_to_move ? "black" : "white") + " lost on time";
+			return loss;
+		}
+
+		uint8_t move = 64;
+		if (move_name.size() == 2 && move_name[0] >= 'a' && move_name[0] <= 'h' && move_name[1] >= '1' && move_name[1] <= '8')
+			move = to_coordinate(move_name[0], move_name[1]);
+		if (move == 64 || !is_set(get_valid_moves(board), move)) {
+			*reason = std::string(black_to_move ? "black" : "white") + " played an illegal move: " + move_name;
+			return loss;
+		}
+
+		engines[1 - engine] << "play " << move_name << std::endl;
+		black_to_move = advance(&board, move, black_to_move);
+	}
+
+	// The game is over, the board is from the perspective of black_to_move
+	int discs = count(board.player) - count(board.opponent);
+	int first_discs = black_to_move == first_black ? discs : -discs;
+	int black_discs = black_to_move ? count(board.player) : count(board.opponent);
+	int white_discs = black_to_move ? count(board.opponent) : count(board.player);
+	*reason = std::to_string(black_discs) + "-" + std::to_string(white_discs);
+	if (first_discs > 0)
+		return GAME_WIN;
+	return first_discs < 0 ? GAME_LOSS : GAME_DRAW;
+}
+
+static void print_status(void) {
+	double elo, margin;
+	printf("Score of %s vs %s: %" PRIu64 " - %" PRIu64 " - %" PRIu64 " [%.3f] %" PRIu64 "\n",
+			settings.engines[0].c_str(), settings.engines[1].c_str(), score.wins, score.losses, score.draws,
+			(score.wins + 0.5 * score.draws) / fmax(games_played, 1), games_played);
+	if (elo_estimate(&score, &elo, &margin))
+		printf("Elo difference: %.1f +/- %.1f\n", elo, margin);
+	if (settings.use_sprt) {
+		printf("SPRT: llr %.3f (%.3f, %.3f)%s\n", sprt_llr(&settings.sprt, &score),
+				sprt_lower_bound(&settings.sprt), sprt_upper_bound(&settings.sprt),
+				decision == SPRT_ACCEPT_H1 ? ", H1 accepted" : (decision == SPRT_ACCEPT_H0 ? ", H0 accepted" : ""));
+	}
+	fflush(stdout);
+}
+
+static void record(uint64_t game, bool first_black, game_result_t result, const std::string &reason) {
+	std::lock_guard<std::mutex> lock(results_lock);
+
+	if (result == GAME_ABORTED) {
+		fprintf(stderr, "ERROR: game %" PRIu64 " aborted, %s\n", game + 1, reason.c_str());
+		failed = true;
+		stopped = true;
+		return;
+	}
+
+	games_played++;
+	if (result == GAME_WIN)
+		score.wins++;
+	else if (result == GAME_DRAW)
+		score.draws++;
+	else
+		score.losses++;
+
+	bool black_won = (result == GAME_WIN) == first_black;
+	printf("Finished game %" PRIu64 " (%s vs %s): %s {%s}\n", game + 1,
+			settings.engines[first_black ? 0 : 1].c_str(), settings.engines[first_black ? 1 : 0].c_str(),
+			result == GAME_DRAW ? "1/2-1/2" : (black_won ? "1-0" : "0-1"), reason.c_str());
+
+	// Games that finish after the decision do not change it
+	if (settings.use_sprt && decision == SPRT_CONTINUE) {
+		decision = sprt_test(&settings.sprt, &score);
+		if (decision != SPRT_CONTINUE)
+			stopped = true;
+	}
+	print_status();
+}
+
+static bool start_engine(redi::pstream &engine, const std::string &command) {
+	engine.open(command, redi::pstreams::pstdout | redi::pstreams::pstdin);
+	if (!engine.is_open())
+		return false;
+	for (const auto &option : settings.options)
+		engine << "setoption name " << option.first << " value " << option.second << std::endl;
+	return true;
+}
+
+static void game_slot(void) {
+	redi::pstream engines[2];
+	for (int i = 0; i < 2; ++i) {
+		if (!start_engine(engines[i], settings.engines[i])) {
+			std::lock_guard<std::mutex> lock(results_lock);
+			fprintf(stderr, "ERROR: could not start %s\n", settings.engines[i].c_str());
+			failed = true;
+			stopped = true;
+			return;
+		}
+	}
+
+	for (uint64_t game = next_game++; !stopped && game < settings.games; game = next_game++) {
+		const std::vector<uint8_t> &opening = settings.openings[(game / 2) % settings.openings.size()];
+		bool first_black = game % 2 == 0;
+		std::string reason;
+		game_result_t result = play_game(engines, opening, first_black, &reason);
+		record(game, first_black, result, reason);
+	}
+
+	for (int i = 0; i < 2; ++i) {
+		engines[i] << "quit" << std::endl;
+		engines[i].close();
+	}
+}
+
+/**
+ * Reads a time control such as 10+0.1, in seconds
+ */
+static bool parse_time_control(const char *text) {
+	char *end;
+	double base = strtod(text, &end);
+	double increment = 0;
+	if (*end == '+')
+		increment = strtod(end + 1, &end);
+	if (*end != '\0' || base <= 0 || increment < 0)
+		return false;
+	settings.base_ms = base * 1000;
+	settings.increment_ms = increment * 1000;
+	return settings.base_ms > 0;
+}
+
+static bool usage(void) {
+	fprintf(stderr, "Usage: ./interface.out match <engine> <engine> [--games <n>] [--concurrency <n>]\n"
+			"                           [--tc <seconds>[+<increment>] | --movetime <ms>]\n"
+			"                           [--openings <file> | --random <plies>] [--seed <n>]\n"
+			"                           [--option <name> <value>]... [--sprt <elo0> <elo1> <alpha> <beta>]\n");
+	return false;
+}
+
+bool run_match(int argc, char *argv[]) {
+	if (argc < 2)
+		return usage();
+
+	settings.engines[0] = argv[0];
+	settings.engines[1] = argv[1];
+	settings.games = 100;
+	settings.concurrency = 1;
+	settings.base_ms = 0;
+	settings.increment_ms = 0;
+	settings.move_time_ms = 1000;
+	settings.use_sprt = false;
+
+	const char *openings_path = NULL;
+	uint8_t random_plies = 6;
+	uint64_t seed = time(NULL);
+
+	for (int i = 2; i < argc; ++i) {
+		int left = argc - i - 1;
+		if (strcmp(argv[i], "--games") == 0 && left >= 1) {
+			settings.games = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--concurrency") == 0 && left >= 1) {
+			settings.concurrency = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--tc") == 0 && left >= 1) {
+			if (!parse_time_control(argv[++i]))
+				return usage();
+		} else if (strcmp(argv[i], "--movetime") == 0 && left >= 1) {
+			settings.base_ms = 0;
+			settings.move_time_ms = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--openings") == 0 && left >= 1) {
+			openings_path = argv[++i];
+		} else if (strcmp(argv[i], "--random") == 0 && left >= 1) {
+			random_plies = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--seed") == 0 && left >= 1) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--option") == 0 && left >= 2) {
+			settings.options.push_back(std::make_pair(argv[i + 1], argv[i + 2]));
+			i += 2;
+		} else if (strcmp(argv[i], "--sprt") == 0 && left >= 4) {
+			settings.use_sprt = true;
+			settings.sprt.elo0 = atof(argv[i + 1]);
+			settings.sprt.elo1 = atof(argv[i + 2]);
+			settings.sprt.alpha = atof(argv[i + 3]);
+			settings.sprt.beta = atof(argv[i + 4]);
+			i += 4;
+		} else {
+			return usage();
+		}
+	}
+
+	if (settings.games < 1 || settings.concurrency < 1 || (settings.base_ms == 0 && settings.move_time_ms == 0))
+		return usage();
+	if (settings.use_sprt && (settings.sprt.elo1 <= settings.sprt.elo0 || settings.sprt.alpha <= 0
+			|| settings.sprt.alpha >= 1 || settings.sprt.beta <= 0 || settings.sprt.beta >= 1))
+		return usage();
+
+	if (openings_path != NULL) {
+		if (!load_openings(openings_path)) {
+			fprintf(stderr, "ERROR: no openings in %s\n", openings_path);
+			return false;
+		}
+	} else {
+		random_openings((settings.games + 1) / 2, random_plies, seed);
+	}
+
+	// A game slot without games would only start engines
+	uint64_t slots = settings.concurrency < settings.games ? settings.concurrency : settings.games;
+	std::vector<std::thread> threads;
+	for (uint64_t i = 0; i < slots; ++i)
+		threads.push_back(std::thread(game_slot));
+	for (std::thread &thread : threads)
+		thread.join();
+
+	printf("Finished match\n");
+	print_status();
+	if (settings.use_sprt && decision == SPRT_CONTINUE)
+		printf("SPRT: no decision after %" PRIu64 " games\n", games_played);
+
+	return !failed;
+}
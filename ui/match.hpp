@@ -0,0 +1,26 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdbool.h>
+
+/**
+ * Plays a match between two engines, several games at once. Every game
+ * slot starts its own pair of engine processes and plays its games one after
+ * the other. Every opening is played twice, once with either engine as
+ * black, so neither engine gets the better openings.
+ *
+ * The time control is a clock per player, with a base time and an increment
+ * per move, or a fixed time per move. The runner keeps the clocks itself and
+ * passes them on with every go. A player whose clock runs out, who plays an
+ * illegal move or whose move is not understood loses the game.
+ *
+ * With --sprt, the match stops as soon as the test accepts one of its
+ * hypotheses. The games that are still being played are finished and
+ * counted, but do not change the decision.
+ *
+ * @param[in] The arguments after "match": the two engines and the options
+ * @return False if the arguments are wrong or an engine quit
+ */
+bool run_match(int argc, char *argv[]);
+
+#endif
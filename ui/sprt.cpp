@@ -0,0 +1,74 @@
+#include "sprt.hpp"
+
+#include <math.h>
+
+/**
+ * The expected score of an engine that is elo stronger
+ */
+static double expected_score(double elo) {
+	return 1 / (1 + pow(10, -elo / 400));
+}
+
+static double score_elo(double score) {
+	return -400 * log10(1 / score - 1);
+}
+
+/**
+ * The mean and variance of the score of a single game
+ */
+static double score_stats(const match_score_t *score, double *variance) {
+	double games = score->wins + score->draws + score->losses;
+	double mean = (score->wins + 0.5 * score->draws) / games;
+	*variance = (score->wins * (1 - mean) * (1 - mean)
+			+ score->draws * (0.5 - mean) * (0.5 - mean)
+			+ score->losses * mean * mean) / games;
+	return mean;
+}
+
+double sprt_llr(const sprt_t *sprt, const match_score_t *score) {
+	uint64_t games = score->wins + score->draws + score->losses;
+	if (games == 0)
+		return 0;
+
+	double variance;
+	double mean = score_stats(score, &variance);
+	if (variance <= 0)
+		return 0;
+
+	double s0 = expected_score(sprt->elo0);
+	double s1 = expected_score(sprt->elo1);
+	return games * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+}
+
+double sprt_lower_bound(const sprt_t *sprt) {
+	return log(sprt->beta / (1 - sprt->alpha));
+}
+
+double sprt_upper_bound(const sprt_t *sprt) {
+	return log((1 - sprt->beta) / sprt->alpha);
+}
+
+sprt_result_t sprt_test(const sprt_t *sprt, const match_score_t *score) {
+	double llr = sprt_llr(sprt, score);
+	if (llr >= sprt_upper_bound(sprt))
+		return SPRT_ACCEPT_H1;
+	if (llr <= sprt_lower_bound(sprt))
+		return SPRT_ACCEPT_H0;
+	return SPRT_CONTINUE;
+}
+
+bool elo_estimate(const match_score_t *score, double *elo, double *margin) {
+	uint64_t games = score->wins + score->draws + score->losses;
+	if (games == 0 || score->wins + score->draws == 0 || score->losses + score->draws == 0)
+		return false;
+
+	double variance;
+	double mean = score_stats(score, &variance);
+	double deviation = 1.96 * sqrt(variance / games);
+
+	*elo = score_elo(mean);
+	double low = fmax(mean - deviation, 1e-9);
+	double high = fmin(mean + deviation, 1 - 1e-9);
+	*margin = (score_elo(high) - score_elo(low)) / 2;
+	return true;
+}
@@ -0,0 +1,57 @@
+#ifndef SPRT_H
+#define SPRT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+/**
+ * The results of a match, from the perspective of the first engine
+ */
+typedef struct {
+	uint64_t wins;
+	uint64_t draws;
+	uint64_t losses;
+} match_score_t;
+
+/**
+ * A sequential probability ratio test of the hypotheses that the first
+ * engine is elo0 stronger (H0) against elo1 stronger (H1), in logistic Elo.
+ * alpha is the chance to accept H1 while H0 is true, beta the chance to
+ * accept H0 while H1 is true.
+ */
+typedef struct {
+	double elo0;
+	double elo1;
+	double alpha;
+	double beta;
+} sprt_t;
+
+typedef enum {
+	SPRT_CONTINUE, SPRT_ACCEPT_H0, SPRT_ACCEPT_H1
+} sprt_result_t;
+
+/**
+ * The log likelihood ratio of H1 against H0, with the game results
+ * approximated by a normal distribution of the same mean and variance
+ * (GSPRT). It is 0 as long as the variance is.
+ */
+double sprt_llr(const sprt_t *sprt, const match_score_t *score);
+
+/**
+ * The bounds at which the test accepts H0 and H1
+ */
+double sprt_lower_bound(const sprt_t *sprt);
+double sprt_upper_bound(const sprt_t *sprt);
+
+sprt_result_t sprt_test(const sprt_t *sprt, const match_score_t *score);
+
+/**
+ * The Elo difference of the first engine, with the margin of its 95%
+ * confidence interval
+ *
+ * @return False without games, or when one engine won every game, as the
+ * difference is infinite then
+ */
+bool elo_estimate(const match_score_t *score, double *elo, double *margin);
+
+#endif